@@ -6,19 +6,53 @@
 #include <algorithm>
 #include <iostream> // TODO: temporarily
 #include <string> // TODO: temporarily
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
+#ifdef __SSSE3__
+#	include <immintrin.h>
+#endif
+
+// Offsets are packed as big-endian 12-bit values, even ones are in high bits of their 16-bit window and odd ones in low bits.
 static inline uint16_t getBitsAt(const uint8_t* data, uint32_t offset)
 {
 	const auto offsetAligned = (offset * 12) / 8;
-	auto result = readAtWithByteSwap<uint16_t>(data, offsetAligned);
-	if ((offset & 0x1) == 0)
-		result >>= 4;
-	return result & UINT16_C(0xFFF);
+	const auto shift = ((offset & 0x1) ^ 0x1) << 2;
+	return static_cast<uint16_t>((readAtWithByteSwap<uint16_t>(data, offsetAligned) >> shift) & UINT16_C(0xFFF));
 }
 
-static inline uint64_t decodeBitsAndAdvance(const uint8_t*& data)
+// Unpacks the first count 12-bit values at once, it is cheaper than probing each value when a whole node is visited.
+static inline void unpackBits(const uint8_t* data, uint32_t count, uint16_t* values)
+{
+	auto i = 0u;
+
+#ifdef __SSSE3__
+	// Eight values are taken from twelve bytes, loads are 16 bytes wide so the loop stops while they are still inside the array.
+	const auto shuffleMask = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const auto evenMask = _mm_setr_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+	const auto oddMask = _mm_setr_epi16(0, 0xFFF, 0, 0xFFF, 0, 0xFFF, 0, 0xFFF);
+	for (; (i + 11) <= count; i += 8) {
+		const auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (i * 12) / 8));
+		const auto windows = _mm_shuffle_epi8(packed, shuffleMask);
+		const auto even = _mm_and_si128(_mm_srli_epi16(windows, 4), evenMask);
+		const auto odd = _mm_and_si128(windows, oddMask);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), _mm_or_si128(even, odd));
+	}
+#endif
+
+	// Each three bytes hold a pair of values.
+	for (; (i + 2) <= count; i += 2) {
+		const auto p = data + (i * 12) / 8;
+		values[i] = static_cast<uint16_t>((p[0] << 4) | (p[1] >> 4));
+		values[i + 1] = static_cast<uint16_t>(((p[1] & 0xF) << 8) | p[2]);
+	}
+	if (i < count) {
+		values[i] = getBitsAt(data, i);
+	}
+}
+
+static inline uint64_t decodeBitsAndAdvanceSlow(const uint8_t*& data)
 {
 	uint64_t value = *data++;
 	uint64_t mask = 0x80;
@@ -29,6 +63,28 @@ static inline uint64_t decodeBitsAndAdvance(const uint8_t*& data)
 	return value;
 }
 
+// Count of leading one bits of the first byte is the count of bytes which follow it, values are big-endian.
+static inline uint64_t decodeBitsAndAdvance(const uint8_t*& data)
+{
+	static const uint8_t s_extraByteCounts[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 4 };
+
+	const uint64_t first = data[0];
+	const auto extraByteCount = s_extraByteCounts[first >> 4];
+	if (extraByteCount > 3) {
+		// Values wider than 28 bits are too rare to be worth a fast path.
+		return decodeBitsAndAdvanceSlow(data);
+	}
+
+	auto value = first & (UINT64_C(0x7F) >> extraByteCount);
+	const auto* p = data + 1;
+	for (auto i = 0u; i < extraByteCount; ++i) {
+		value = (value << 8) | *p++;
+	}
+	data = p;
+
+	return value;
+}
+
 template<typename Derived, typename Key>
 class BTree
 {
@@ -55,6 +111,14 @@ private:
 public:
 	typedef Key KeyType;
 
+	// Node as visited by traverse(), once starts of all nodes are known they can be decoded independently.
+	struct NodeRef
+	{
+		const uint8_t* data;
+		unsigned int firstKeyIndex;
+		unsigned int keyCount;
+	};
+
 	enum class CallbackResult
 	{
 		STOP,
@@ -62,6 +126,9 @@ public:
 	};
 
 	static const auto INVALID_INDEX = ~0u;
+
+	// Key count of a node is stored in 11 bits.
+	static const auto MAX_NODE_KEY_COUNT = 0x7FFu;
 	
 	const uint8_t* getByIndex(unsigned int index) const
 	{
@@ -185,6 +252,20 @@ public:
 		}
 	}
 	
+	// Resolves many keys at once, results are the same as of searchByKey() for each key. The tree is descended once for all keys,
+	// each node on the way is unpacked once and keys which fall into the same child node are searched in it together. Keys
+	// should be sorted in the tree order to share most of the work (keys in any other order are still resolved correctly).
+	void searchBatch(Span<Key> keys, unsigned int* indices) const
+	{
+		if (keys.empty())
+			return;
+
+		const auto count = static_cast<unsigned int>(readAtWithByteSwap<uint8_t>(m_data, 0));
+		const auto offset = readAtWithByteSwap<uint32_t>(m_data, 0) & UINT32_C(0xFFFFFF);
+
+		searchBatchAt(advancePointer(m_data, offset), count, count, 0, keys.data(), keys.size(), indices);
+	}
+
 	template<typename TraverseFunctor>
 	unsigned int traverse(TraverseFunctor& traverseFunctor) const
 	{
@@ -197,13 +278,16 @@ public:
 		
 		UNUSED(offsetAndCount);
 		
+		uint16_t offsets[MAX_NODE_KEY_COUNT + 2];
+
 		auto visitedKeyCount = 0u;
 		for (auto i = 0u; i < nodeCount; ++i) {
 			const auto high = getBitsAt(p, 0) & UINT32_C(0x7FF);
-			const auto nextOffset = getBitsAt(p, high + 1);
+			unpackBits(p, high + 2, offsets);
+			const auto nextOffset = offsets[high + 1];
 			
 			for (auto j = 0u; j < high; ++j) {
-				const auto offset = getBitsAt(p, j + 1);
+				const auto offset = offsets[j + 1];
 				const auto data = advancePointer(p, offset);
 				
 				Key key;
@@ -220,12 +304,157 @@ public:
 	done:
 		return visitedKeyCount;
 	}
+
+	// Walks only the node headers, keys are not decoded.
+	void collectNodes(std::vector<NodeRef>& nodes) const
+	{
+		auto p = m_data;
+
+		const auto offsetAndCount = readNextWithByteSwap<uint32_t>(p);
+		const auto nodeCount = readNextWithByteSwap<uint16_t>(p);
+
+		UNUSED(offsetAndCount);
+
+		nodes.clear();
+		nodes.reserve(nodeCount);
+
+		auto keyIndex = 0u;
+		for (auto i = 0u; i < nodeCount; ++i) {
+			const auto high = getBitsAt(p, 0) & UINT32_C(0x7FF);
+			const auto nextOffset = getBitsAt(p, high + 1);
+
+			nodes.push_back({ p, keyIndex, high });
+			keyIndex += high;
+
+			p = advancePointer(p, nextOffset);
+		}
+	}
+
+	// Visits keys of a single node, the functor gets index of the key in the tree along with the key.
+	template<typename TraverseFunctor>
+	unsigned int traverseNode(const NodeRef& node, TraverseFunctor& traverseFunctor) const
+	{
+		const auto& self = static_cast<const Derived&>(*this);
+
+		uint16_t offsets[MAX_NODE_KEY_COUNT + 1];
+		unpackBits(node.data, node.keyCount + 1, offsets);
+
+		auto visitedKeyCount = 0u;
+		for (auto j = 0u; j < node.keyCount; ++j) {
+			const auto offset = offsets[j + 1];
+			const auto data = advancePointer(node.data, offset);
+
+			Key key;
+			if (self.parseData(key, data)) {
+				++visitedKeyCount;
+				if (!traverseFunctor(node.firstKeyIndex + j, key))
+					break;
+			}
+		}
+
+		return visitedKeyCount;
+	}
 	
 protected:
 	explicit BTree(const uint8_t* data)
 		: m_data(data)
 	{
 	}
+
+	void searchBatchAt(const uint8_t* data, unsigned int count, unsigned int levelCount, unsigned int maxIndex, Key* keys, size_t keyCount, unsigned int* indices) const
+	{
+		const auto& self = static_cast<const Derived&>(*this);
+
+		// Offsets of the node are unpacked once, then keys are matched against it one after another.
+		const auto high = getBitsAt(data, 0) & UINT32_C(0x7FF);
+		uint16_t offsets[MAX_NODE_KEY_COUNT + 2];
+		unpackBits(data, high + 1, offsets);
+
+		if (levelCount == 0) {
+			const auto firstIndex = (count != 0) ? maxIndex - high : 0u;
+
+			auto position = 0u;
+			for (auto i = size_t(0); i < keyCount; ++i) {
+				int ret;
+				position = seekInNode(data, offsets, high, position, keys[i], &Derived::equalKeyCompareOp, ret);
+				if (position < high && ret == 0) {
+					indices[i] = firstIndex + position;
+					self.parseData(keys[i], advancePointer(data, offsets[position + 1]));
+				} else {
+					indices[i] = INVALID_INDEX;
+				}
+			}
+			return;
+		}
+
+		// Child of a key is the first one whose separator is not less than the key, so a run of keys with the same child is
+		// searched in it together and each key is compared with few separators only.
+		int ret;
+		auto child = seekInNode(data, offsets, high, 0, keys[0], &Derived::lessThanKeyCompareOp, ret);
+		for (auto i = size_t(0); i < keyCount; ) {
+			const auto runChild = child;
+			auto last = i + 1;
+			for (; last < keyCount; ++last) {
+				child = seekInNode(data, offsets, high, child, keys[last], &Derived::lessThanKeyCompareOp, ret);
+				if (child != runChild)
+					break;
+			}
+
+			if (runChild < high) {
+				auto childData = advancePointer(data, offsets[runChild + 1]);
+				const auto childMaxIndex = static_cast<uint32_t>(decodeBitsAndAdvance(childData));
+				childData = self.advanceData(childData);
+				const auto nextOffset = static_cast<uint32_t>(decodeBitsAndAdvance(childData));
+
+				searchBatchAt(advancePointer(m_data, nextOffset), count, levelCount - 1, childMaxIndex, keys + i, last - i, indices + i);
+			} else {
+				std::fill(indices + i, indices + last, INVALID_INDEX);
+			}
+
+			i = last;
+		}
+	}
+
+	// Returns position of the first key of the node which is not less than the searched one (or count if there is none) along
+	// with result of their comparison. The search gallops forward from the given position, so keys in the tree order cost few
+	// comparisons each, a key which lies before the position is searched from the start of the node.
+	unsigned int seekInNode(const uint8_t* data, const uint16_t* offsets, unsigned int count, unsigned int from, const Key& key, KeyCompareOp compOp, int& ret) const
+	{
+		const auto& self = static_cast<const Derived&>(*this);
+		const auto compareAt = [&self, data, offsets, &key, compOp](unsigned int position) {
+			return (self.*compOp)(key, advancePointer(data, offsets[position + 1]));
+		};
+
+		if (from != 0 && compareAt(from - 1) <= 0)
+			from = 0;
+
+		auto low = from, high = count;
+		ret = 1;
+
+		for (auto probe = from, step = 1u; probe < count; probe = from + step - 1) {
+			const auto probeRet = compareAt(probe);
+			if (probeRet <= 0) {
+				high = probe;
+				ret = probeRet;
+				break;
+			}
+			low = probe + 1;
+			step *= 2;
+		}
+
+		while (low < high) {
+			const auto mid = low + (high - low) / 2;
+			const auto midRet = compareAt(mid);
+			if (midRet > 0) {
+				low = mid + 1;
+			} else {
+				high = mid;
+				ret = midRet;
+			}
+		}
+
+		return low;
+	}
 	
 	const uint8_t* searchWithComparison(SearchResult& result, const uint8_t* data, unsigned int count, const Key& key, KeyCompareOp compOp) const
 	{
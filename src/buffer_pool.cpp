@@ -0,0 +1,63 @@
+#include "buffer_pool.hpp"
+
+ByteBuffer BufferPool::acquire(size_t size)
+{
+	ByteBuffer buffer;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto bestIndex = m_buffers.size();
+		for (auto i = size_t(0); i < m_buffers.size(); ++i) {
+			const auto capacity = m_buffers[i].capacity();
+			if (capacity >= size && (bestIndex == m_buffers.size() || capacity < m_buffers[bestIndex].capacity())) {
+				bestIndex = i;
+			}
+		}
+
+		if (bestIndex != m_buffers.size()) {
+			buffer.swap(m_buffers[bestIndex]);
+			m_buffers[bestIndex].swap(m_buffers.back());
+			m_buffers.pop_back();
+			m_retainedSize -= buffer.capacity();
+		}
+	}
+
+	buffer.resize(size);
+
+	return buffer;
+}
+
+void BufferPool::release(ByteBuffer& buffer)
+{
+	const auto capacity = buffer.capacity();
+	if (capacity == 0) {
+		return;
+	}
+
+	buffer.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_buffers.size() < MAX_BUFFER_COUNT && m_retainedSize + capacity <= m_maxRetainedSize) {
+			m_buffers.emplace_back();
+			m_buffers.back().swap(buffer);
+			m_retainedSize += capacity;
+			return;
+		}
+	}
+
+	ByteBuffer().swap(buffer);
+}
+
+void BufferPool::clear()
+{
+	std::vector<ByteBuffer> buffers;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		buffers.swap(m_buffers);
+		m_retainedSize = 0;
+	}
+}
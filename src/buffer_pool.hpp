@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.hpp"
+#include "util.hpp"
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Allocator adaptor which default-initializes elements constructed without arguments, so resizing a vector of bytes does not
+// zero memory that is overwritten right away anyway.
+template<typename T, typename A = std::allocator<T>>
+class DefaultInitAllocator
+	: public A
+{
+	typedef std::allocator_traits<A> Traits;
+
+public:
+	template<typename U>
+	struct rebind
+	{
+		typedef DefaultInitAllocator<U, typename Traits::template rebind_alloc<U>> other;
+	};
+
+	using A::A;
+
+	template<typename U>
+	void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value)
+	{
+		::new(static_cast<void*>(ptr)) U;
+	}
+
+	template<typename U, typename... Args>
+	void construct(U* ptr, Args&&... args)
+	{
+		Traits::construct(static_cast<A&>(*this), ptr, std::forward<Args>(args)...);
+	}
+};
+
+typedef std::vector<uint8_t, DefaultInitAllocator<uint8_t>> ByteBuffer;
+
+inline ByteSpan makeSpan(ByteBuffer& buffer)
+{
+	return ByteSpan(buffer.data(), buffer.size());
+}
+
+inline ConstByteSpan makeSpan(const ByteBuffer& buffer)
+{
+	return ConstByteSpan(buffer.data(), buffer.size());
+}
+
+// Keeps storage of released buffers for reuse, so working buffers of nodes stop hitting the allocator and faulting fresh pages.
+// Buffers are handed over between threads (e.g. from a reader to a writer), so the pool is shared and guarded by a mutex which
+// is held only to pick or put a buffer.
+class BufferPool
+	: private boost::noncopyable
+{
+public:
+	static const auto DEFAULT_MAX_RETAINED_SIZE = size_t(0x4000000);
+	static const auto MAX_BUFFER_COUNT = size_t(256);
+
+	explicit BufferPool(size_t maxRetainedSize = DEFAULT_MAX_RETAINED_SIZE)
+		: m_maxRetainedSize(maxRetainedSize)
+		, m_retainedSize(0)
+	{
+	}
+
+	// Returns a buffer of the given size with unspecified contents, the smallest retained buffer that fits is reused.
+	ByteBuffer acquire(size_t size);
+
+	// Takes storage of the buffer back and leaves it empty, buffers which would exceed the retained size are freed.
+	void release(ByteBuffer& buffer);
+
+	void clear();
+
+private:
+	const size_t m_maxRetainedSize;
+
+	std::mutex m_mutex;
+	std::vector<ByteBuffer> m_buffers;
+	size_t m_retainedSize;
+};
@@ -1,82 +1,492 @@
 #include "compression.hpp"
 
-#include <iterator>
-
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
-#include <boost/iostreams/write.hpp>
-
-bool FileExpand::inflate(std::vector<uint8_t>& out, const uint8_t* data, size_t dataSize) {
-	if (data && dataSize > 0) {
-		try {
-			boost::iostreams::zlib_params params;
-			params.window_bits = -boost::iostreams::zlib::default_window_bits;
-			
-			boost::iostreams::filtering_ostream os;
-			os.push(boost::iostreams::zlib_decompressor(params));
-			os.push(std::back_inserter(out));
-			
-			boost::iostreams::write(os, reinterpret_cast<const char*>(data), dataSize);
-		}
-		catch (const std::exception& e) {
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#include <boost/noncopyable.hpp>
+
+#include <zlib.h>
+
+#ifdef USE_LIBDEFLATE
+#	include <libdeflate.h>
+#endif
+
+#ifdef USE_LIBDEFLATE
+
+// Decompressor holds only lookup tables, so one per thread is enough and it does not need resetting between streams.
+class InflateContext
+	: private boost::noncopyable
+{
+public:
+	InflateContext()
+		: m_decompressor(libdeflate_alloc_decompressor())
+	{
+	}
+
+	~InflateContext()
+	{
+		if (m_decompressor) {
+			libdeflate_free_decompressor(m_decompressor);
+		}
+	}
+
+	bool inflate(uint8_t* out, size_t outSize, const uint8_t* data, size_t dataSize, size_t* outProduced)
+	{
+		if (outProduced) {
+			*outProduced = 0;
+		}
+		if (!m_decompressor) {
+			return false;
+		}
+
+		size_t producedSize = 0;
+		const auto result = libdeflate_deflate_decompress(m_decompressor, data, dataSize, out, outSize, &producedSize);
+		if (result != LIBDEFLATE_SUCCESS) {
 			return false;
 		}
+
+		if (outProduced) {
+			*outProduced = producedSize;
+		}
+
+		return true;
+	}
+
+private:
+	libdeflate_decompressor* m_decompressor;
+};
+
+#else
+
+// Stream state is allocated once per thread and only reset for every new stream.
+class InflateContext
+	: private boost::noncopyable
+{
+public:
+	InflateContext()
+		: m_initialized(false)
+	{
+		std::memset(&m_stream, 0, sizeof(m_stream));
+	}
+
+	~InflateContext()
+	{
+		if (m_initialized) {
+			inflateEnd(&m_stream);
+		}
+	}
+
+	bool inflate(uint8_t* out, size_t outSize, const uint8_t* data, size_t dataSize, size_t* outProduced)
+	{
+		if (outProduced) {
+			*outProduced = 0;
+		}
+
+		if (!m_initialized) {
+			if (inflateInit2(&m_stream, -MAX_WBITS) != Z_OK) {
+				return false;
+			}
+			m_initialized = true;
+		} else if (inflateReset(&m_stream) != Z_OK) {
+			return false;
+		}
+
+		// Sizes are fed in pieces because zlib counters are limited to unsigned int.
+		auto inRemaining = dataSize;
+		auto outRemaining = outSize;
+
+		m_stream.next_in = const_cast<Bytef*>(data);
+		m_stream.avail_in = 0;
+		m_stream.next_out = out;
+		m_stream.avail_out = 0;
+
+		int ret;
+		do {
+			if (m_stream.avail_in == 0 && inRemaining != 0) {
+				m_stream.avail_in = static_cast<uInt>(std::min<size_t>(inRemaining, UINT_MAX));
+				inRemaining -= m_stream.avail_in;
+			}
+			if (m_stream.avail_out == 0 && outRemaining != 0) {
+				m_stream.avail_out = static_cast<uInt>(std::min<size_t>(outRemaining, UINT_MAX));
+				outRemaining -= m_stream.avail_out;
+			}
+
+			ret = ::inflate(&m_stream, Z_NO_FLUSH);
+		} while (ret == Z_OK);
+
+		if (outProduced) {
+			*outProduced = static_cast<size_t>(m_stream.next_out - out);
+		}
+
+		return (ret == Z_STREAM_END);
+	}
+
+private:
+	z_stream m_stream;
+	bool m_initialized;
+};
+
+#endif
+
+bool FileExpand::inflate(uint8_t* out, size_t outSize, const uint8_t* data, size_t dataSize, size_t* outProduced)
+{
+	static thread_local InflateContext s_context;
+
+	if (!data || dataSize == 0) {
+		if (outProduced) {
+			*outProduced = 0;
+		}
+		return true;
+	}
+
+	return s_context.inflate(out, outSize, data, dataSize, outProduced);
+}
+
+bool FileExpand::checkIfExpanded(ConstByteSpan data)
+{
+	if (!checkIfExpandedHeader(data.data(), data.size())) {
+		return false;
+	}
+	const auto superHdr = reinterpret_cast<const SuperHeader*>(data.data());
+	if (data.size() < superHdr->fileSize) {
+		return false;
 	}
 	
 	return true;
 }
 
-bool FileExpand::checkIfExpanded(const std::vector<uint8_t>& data)
+bool FileExpand::checkIfExpandedHeader(const uint8_t* data, size_t dataSize)
 {
-	if (data.size() < sizeof(SuperHeader)) {
+	static_assert(sizeof(SuperHeader) == SUPER_HEADER_SIZE, "Unexpected super header size");
+
+	if (dataSize < sizeof(SuperHeader)) {
 		return false;
 	}
-	const auto superHdr = reinterpret_cast<const SuperHeader*>(data.data());
+	const auto superHdr = reinterpret_cast<const SuperHeader*>(data);
 	if (superHdr->magic != MAGIC) {
 		return false;
 	}
 	if (superHdr->segmentSize == 0 || (superHdr->segmentSize % ALIGNMENT != 0)) {
 		return false;
 	}
-	if (data.size() < superHdr->fileSize) {
-		return false;
-	}
-	
+
 	return true;
 }
 
-bool FileExpand::unexpand(const std::vector<uint8_t>& in, std::vector<uint8_t>& out)
+size_t FileExpand::getUnexpandedSize(ConstByteSpan data)
 {
+	const auto superHdr = reinterpret_cast<const SuperHeader*>(data.data());
+
+	return superHdr->decompressedFileSize;
+}
+
+bool FileExpand::unexpand(ConstByteSpan in, ByteSpan out, size_t* outProduced, ThreadPool* threadPool)
+{
+	if (outProduced) {
+		*outProduced = 0;
+	}
 	if (!checkIfExpanded(in)) {
 		return false;
 	}
-	
+
 	const auto superHdr = reinterpret_cast<const SuperHeader*>(in.data());
+	if (out.size() < superHdr->decompressedFileSize) {
+		return false;
+	}
+	if (!threadPool) {
+		return unexpandSequentially(in, out, outProduced);
+	}
+
 	const auto segmentCount = (superHdr->fileSize + superHdr->segmentSize - 1) / superHdr->segmentSize;
 
-	out.clear();
-	out.reserve(superHdr->decompressedFileSize);
-	
-	boost::iostreams::zlib_params params;
-	params.window_bits = -boost::iostreams::zlib::default_window_bits;
-	
+	struct Segment
+	{
+		const SegmentHeader* header;
+		size_t outOffset;
+	};
+
+	// Output offsets are prefix sums of segment sizes, if they do not add up then segments are inflated one by one.
+	std::vector<Segment> segments(segmentCount);
+	auto outOffset = size_t(0);
+	for (auto i = 0u; i < segmentCount; ++i) {
+		// Header of the last segment may be cut off, so it is checked to be inside of the input before it is read.
+		const auto segmentHdrOffset = (i == 0) ? sizeof(SuperHeader) : static_cast<size_t>(superHdr->segmentSize) * i;
+		const auto segmentDataOffset = segmentHdrOffset + sizeof(SegmentHeader);
+		if (segmentDataOffset > in.size()) {
+			return false;
+		}
+		const auto segmentHdr = reinterpret_cast<const SegmentHeader*>(in.data() + segmentHdrOffset);
+		if (segmentHdr->zSize > in.size() - segmentDataOffset) {
+			return false;
+		}
+
+		segments[i] = { segmentHdr, outOffset };
+		outOffset += segmentHdr->size;
+	}
+	if (outOffset != superHdr->decompressedFileSize) {
+		return unexpandSequentially(in, out, outProduced);
+	}
+
+	std::atomic<bool> failed(false);
+	{
+		TaskGroup taskGroup(threadPool);
+
+		for (auto first = size_t(0); first < segments.size();) {
+			auto last = first + 1;
+			while (last < segments.size() && segments[last].outOffset - segments[first].outOffset < PARALLEL_TASK_SIZE) {
+				++last;
+			}
+
+			taskGroup.run([&segments, out, &failed, first, last]() {
+				for (auto i = first; i < last && !failed; ++i) {
+					const auto& segment = segments[i];
+					const auto segmentData = reinterpret_cast<const uint8_t*>(segment.header + 1);
+
+					auto producedSize = size_t(0);
+					if (!inflate(out.data() + segment.outOffset, segment.header->size, segmentData, segment.header->zSize, &producedSize) || producedSize != segment.header->size) {
+						failed = true;
+					}
+				}
+			});
+
+			first = last;
+		}
+
+		taskGroup.wait();
+	}
+	if (failed) {
+		return false;
+	}
+
+	if (outProduced) {
+		*outProduced = superHdr->decompressedFileSize;
+	}
+
+	return true;
+}
+
+bool FileExpand::unexpandSequentially(ConstByteSpan in, ByteSpan out, size_t* outProduced)
+{
+	const auto superHdr = reinterpret_cast<const SuperHeader*>(in.data());
+	const auto segmentCount = (superHdr->fileSize + superHdr->segmentSize - 1) / superHdr->segmentSize;
+
+	// Segments are inflated back to back straight into the final buffer.
+	auto offset = size_t(0);
 	auto status = true;
 	for (auto i = 0u; i < segmentCount; ++i) {
-		const auto segmentHdr = (i == 0)
-			? reinterpret_cast<const SegmentHeader*>(superHdr + 1)
-			: reinterpret_cast<const SegmentHeader*>(reinterpret_cast<const uint8_t*>(superHdr) + static_cast<size_t>(superHdr->segmentSize) * i)
-		;
+		const auto segmentHdrOffset = (i == 0) ? sizeof(SuperHeader) : static_cast<size_t>(superHdr->segmentSize) * i;
+		const auto segmentDataOffset = segmentHdrOffset + sizeof(SegmentHeader);
+		if (segmentDataOffset > in.size()) {
+			status = false;
+			break;
+		}
+		const auto segmentHdr = reinterpret_cast<const SegmentHeader*>(in.data() + segmentHdrOffset);
+		if (segmentHdr->zSize > in.size() - segmentDataOffset) {
+			status = false;
+			break;
+		}
+
+		const auto segmentData = in.data() + segmentDataOffset;
 
-		const auto segmentData = reinterpret_cast<const uint8_t*>(segmentHdr + 1);
-		if (!inflate(out, segmentData, segmentHdr->zSize)) {
+		auto producedSize = size_t(0);
+		const auto result = inflate(out.data() + offset, out.size() - offset, segmentData, segmentHdr->zSize, &producedSize);
+		offset += producedSize;
+		if (!result) {
 			status = false;
 			break;
 		}
 	}
-	
-	if (out.size() != superHdr->decompressedFileSize) {
+	if (outProduced) {
+		*outProduced = offset;
+	}
+
+	if (offset != superHdr->decompressedFileSize) {
 		status = false;
 	}
 	
 	return status;
 }
+
+StreamInflater::StreamInflater()
+	: m_stream(new z_stream())
+	, m_initialized(false)
+	, m_finished(false)
+{
+}
+
+StreamInflater::~StreamInflater()
+{
+	if (m_initialized) {
+		inflateEnd(m_stream.get());
+	}
+}
+
+bool StreamInflater::reset()
+{
+	m_finished = false;
+
+	if (!m_initialized) {
+		if (inflateInit2(m_stream.get(), -MAX_WBITS) != Z_OK) {
+			return false;
+		}
+		m_initialized = true;
+		return true;
+	}
+
+	return inflateReset(m_stream.get()) == Z_OK;
+}
+
+bool StreamInflater::write(const uint8_t* data, size_t dataSize, const Sink& sink)
+{
+	if (!m_initialized && !reset()) {
+		return false;
+	}
+	if (m_buffer.empty()) {
+		m_buffer.resize(BUFFER_SIZE);
+	}
+
+	auto& stream = *m_stream;
+
+	while (dataSize != 0 && !m_finished) {
+		const auto inSize = std::min<size_t>(dataSize, UINT_MAX);
+
+		stream.next_in = const_cast<Bytef*>(data);
+		stream.avail_in = static_cast<uInt>(inSize);
+
+		// Output buffer is flushed to the sink every time it fills up, until the whole input piece is consumed.
+		do {
+			stream.next_out = m_buffer.data();
+			stream.avail_out = static_cast<uInt>(m_buffer.size());
+
+			const auto ret = ::inflate(&stream, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				return false;
+			}
+
+			const auto producedSize = m_buffer.size() - stream.avail_out;
+			if (producedSize != 0 && !sink(m_buffer.data(), producedSize)) {
+				return false;
+			}
+
+			if (ret == Z_STREAM_END) {
+				m_finished = true;
+				break;
+			}
+			if (ret == Z_BUF_ERROR && producedSize == 0) {
+				break;
+			}
+		} while (stream.avail_in != 0 || stream.avail_out == 0);
+
+		data += inSize;
+		dataSize -= inSize;
+	}
+
+	return true;
+}
+
+FileUnexpander::FileUnexpander(Sink sink)
+	: m_sink(std::move(sink))
+	, m_state(State::SuperHeader)
+	, m_superHdr()
+	, m_segmentHdr()
+	, m_headerOffset(0)
+	, m_offset(0)
+	, m_segmentDataRemaining(0)
+	, m_nextSegmentOffset(0)
+	, m_producedSize(0)
+	, m_failed(false)
+{
+}
+
+bool FileUnexpander::write(const uint8_t* data, size_t dataSize)
+{
+	const auto sink = [this](const uint8_t* data, size_t dataSize) {
+		m_producedSize += dataSize;
+		return m_producedSize <= m_superHdr.decompressedFileSize && m_sink(data, dataSize);
+	};
+
+	while (dataSize != 0 && !m_failed && m_state != State::Done) {
+		auto size = size_t(0);
+
+		switch (m_state) {
+			case State::SuperHeader:
+			case State::SegmentHeader:
+			{
+				const auto isSuperHeader = (m_state == State::SuperHeader);
+				const auto header = isSuperHeader ? reinterpret_cast<uint8_t*>(&m_superHdr) : reinterpret_cast<uint8_t*>(&m_segmentHdr);
+				const auto headerSize = isSuperHeader ? sizeof(m_superHdr) : sizeof(m_segmentHdr);
+
+				size = std::min(dataSize, headerSize - m_headerOffset);
+				std::memcpy(header + m_headerOffset, data, size);
+				m_headerOffset += size;
+				if (m_headerOffset < headerSize) {
+					break;
+				}
+				m_headerOffset = 0;
+
+				if (isSuperHeader) {
+					if (!FileExpand::checkIfExpandedHeader(reinterpret_cast<const uint8_t*>(&m_superHdr), sizeof(m_superHdr))) {
+						m_failed = true;
+						break;
+					}
+					m_nextSegmentOffset = 0;
+					m_state = State::SegmentHeader;
+				} else {
+					m_nextSegmentOffset += m_superHdr.segmentSize;
+					m_segmentDataRemaining = m_segmentHdr.zSize;
+					if (!m_inflater.reset()) {
+						m_failed = true;
+						break;
+					}
+					m_state = State::SegmentData;
+				}
+				break;
+			}
+
+			case State::SegmentData:
+			{
+				size = static_cast<size_t>(std::min<uint64_t>(dataSize, m_segmentDataRemaining));
+				if (!m_inflater.write(data, size, sink)) {
+					m_failed = true;
+					break;
+				}
+				m_segmentDataRemaining -= size;
+				break;
+			}
+
+			case State::Padding:
+			{
+				const auto segmentEndOffset = std::min<uint64_t>(m_nextSegmentOffset, m_superHdr.fileSize);
+				size = static_cast<size_t>(std::min<uint64_t>(dataSize, segmentEndOffset - std::min(m_offset, segmentEndOffset)));
+				break;
+			}
+
+			default:
+				break;
+		}
+
+		data += size;
+		dataSize -= size;
+		m_offset += size;
+
+		// Segments start at fixed strides, once the stride is reached either a new segment starts or file ends.
+		if (m_state == State::SegmentData && m_segmentDataRemaining == 0) {
+			if (m_segmentHdr.zSize != 0 && !m_inflater.finished()) {
+				m_failed = true;
+			}
+			m_state = State::Padding;
+		}
+		if (m_state == State::Padding && m_offset >= std::min<uint64_t>(m_nextSegmentOffset, m_superHdr.fileSize)) {
+			m_state = (m_nextSegmentOffset >= m_superHdr.fileSize) ? State::Done : State::SegmentHeader;
+		}
+	}
+
+	return !m_failed;
+}
+
+bool FileUnexpander::finish()
+{
+	return !m_failed && m_state == State::Done && m_producedSize == m_superHdr.decompressedFileSize;
+}
@@ -1,18 +1,47 @@
 #pragma once
 
 #include "common.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
 
+#include <functional>
+#include <memory>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
+
+struct z_stream_s;
+
 class FileExpand
 {
 public:
-	static bool inflate(std::vector<uint8_t>& out, const uint8_t* data, size_t dataSize);
+	// Inflates raw deflate stream into a buffer of known size, returns false if stream is corrupted or does not fit.
+	// Number of bytes actually written is stored to outProduced even on failure.
+	static bool inflate(uint8_t* out, size_t outSize, const uint8_t* data, size_t dataSize, size_t* outProduced = nullptr);
 	
-	static bool checkIfExpanded(const std::vector<uint8_t>& data);
-	static bool unexpand(const std::vector<uint8_t>& in, std::vector<uint8_t>& out);
+	static const auto SUPER_HEADER_SIZE = size_t(0x20);
+
+	static bool checkIfExpanded(ConstByteSpan data);
+
+	// Checks only the super header, so it can be used on the leading bytes of a stream.
+	static bool checkIfExpandedHeader(const uint8_t* data, size_t dataSize);
+
+	// Size of unexpanded data, data must be accepted by checkIfExpanded().
+	static size_t getUnexpandedSize(ConstByteSpan data);
+
+	// Segments are independent deflate streams, if a thread pool is given they are inflated concurrently into their final
+	// offsets which come from segment sizes. Output must be at least of unexpanded size, number of bytes written is stored
+	// to outProduced.
+	static bool unexpand(ConstByteSpan in, ByteSpan out, size_t* outProduced = nullptr, ThreadPool* threadPool = nullptr);
 
 private:
+	friend class FileUnexpander;
+
+	// Minimum amount of output inflated by one task in parallel mode, neighbouring segments are grouped up to it.
+	static const auto PARALLEL_TASK_SIZE = size_t(0x40000);
+
+	static bool unexpandSequentially(ConstByteSpan in, ByteSpan out, size_t* outProduced);
+
 	static const auto MAGIC = UINT32_C(0xFFF7F32F);
 	
 	static const auto ALIGNMENT = 0x400;
@@ -35,3 +64,74 @@ private:
 		uint32_t checkSum;
 	};
 };
+
+// Incremental raw deflate decompressor, compressed data is pushed in pieces of any size and output is passed to the sink
+// in pieces of up to BUFFER_SIZE bytes.
+class StreamInflater
+	: private boost::noncopyable
+{
+public:
+	typedef std::function<bool(const uint8_t* data, size_t dataSize)> Sink;
+
+	static const auto BUFFER_SIZE = size_t(0x10000);
+
+	StreamInflater();
+	~StreamInflater();
+
+	bool reset();
+
+	// Returns false if data is corrupted or sink fails, data after the end of stream is ignored.
+	bool write(const uint8_t* data, size_t dataSize, const Sink& sink);
+
+	bool finished() const { return m_finished; }
+
+private:
+	std::unique_ptr<z_stream_s> m_stream;
+	std::vector<uint8_t> m_buffer;
+
+	bool m_initialized;
+	bool m_finished;
+};
+
+// Push-based variant of FileExpand::unexpand, expanded file is fed in pieces of any size and unexpanded data is passed to
+// the sink as segments are inflated, so neither the whole input nor the whole output needs to be held in memory.
+class FileUnexpander
+	: private boost::noncopyable
+{
+public:
+	typedef StreamInflater::Sink Sink;
+
+	explicit FileUnexpander(Sink sink);
+
+	bool write(const uint8_t* data, size_t dataSize);
+
+	// Checks that the whole file was consumed and produced size matches the one from the header.
+	bool finish();
+
+	uint64_t producedSize() const { return m_producedSize; }
+
+private:
+	enum class State
+	{
+		SuperHeader,
+		SegmentHeader,
+		SegmentData,
+		Padding,
+		Done,
+	};
+
+	Sink m_sink;
+	StreamInflater m_inflater;
+
+	State m_state;
+	FileExpand::SuperHeader m_superHdr;
+	FileExpand::SegmentHeader m_segmentHdr;
+	size_t m_headerOffset;
+
+	uint64_t m_offset;
+	uint64_t m_segmentDataRemaining;
+	uint64_t m_nextSegmentOffset;
+	uint64_t m_producedSize;
+
+	bool m_failed;
+};
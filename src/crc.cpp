@@ -1,5 +1,12 @@
 #include "crc.hpp"
 
+#include <cstring>
+
+#if defined(__PCLMUL__) && defined(__SSSE3__)
+#	include <immintrin.h>
+#	define CRC_USE_PCLMUL
+#endif
+
 const std::array<uint32_t, 256> g_crc32_0x04C11DB7 = {{
 	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B,
 	0x1A864DB2, 0x1E475005, 0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61,
@@ -45,3 +52,131 @@ const std::array<uint32_t, 256> g_crc32_0x04C11DB7 = {{
 	0x933EB0BB, 0x97FFAD0C, 0xAFB010B1, 0xAB710D06, 0xA6322BDF, 0xA2F33668,
 	0xBCB4666D, 0xB8757BDA, 0xB5365D03, 0xB1F740B4,
 }};
+
+static const auto CRC32_POLY = UINT32_C(0x04C11DB7);
+
+static constexpr Crc32SlicingTables generateSlicingTables()
+{
+	Crc32SlicingTables tables = {};
+
+	for (auto i = 0u; i < 256; ++i) {
+		auto crc = static_cast<uint32_t>(i) << 24;
+		for (auto j = 0; j < 8; ++j) {
+			crc = (crc & UINT32_C(0x80000000)) ? ((crc << 1) ^ CRC32_POLY) : (crc << 1);
+		}
+		tables.table[0][i] = crc;
+	}
+
+	for (auto k = 1u; k < Crc32SlicingTables::SLICE_COUNT; ++k) {
+		for (auto i = 0u; i < 256; ++i) {
+			const auto prev = tables.table[k - 1][i];
+			tables.table[k][i] = (prev << 8) ^ tables.table[0][prev >> 24];
+		}
+	}
+
+	return tables;
+}
+
+constexpr Crc32SlicingTables g_crc32_0x04C11DB7_slicing = generateSlicingTables();
+
+static uint32_t crc32_0x04C11DB7Slicing(const uint8_t* data, size_t dataSize, uint32_t crc)
+{
+	const auto& t = g_crc32_0x04C11DB7_slicing.table;
+
+	while (dataSize >= 16) {
+		const auto word = (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+		crc ^= word;
+
+		crc =
+			t[15][crc >> 24] ^ t[14][(crc >> 16) & 0xFF] ^ t[13][(crc >> 8) & 0xFF] ^ t[12][crc & 0xFF] ^
+			t[11][data[4]] ^ t[10][data[5]] ^ t[9][data[6]] ^ t[8][data[7]] ^
+			t[7][data[8]] ^ t[6][data[9]] ^ t[5][data[10]] ^ t[4][data[11]] ^
+			t[3][data[12]] ^ t[2][data[13]] ^ t[1][data[14]] ^ t[0][data[15]]
+		;
+
+		data += 16;
+		dataSize -= 16;
+	}
+
+	while (dataSize-- > 0) {
+		crc = (crc << 8) ^ t[0][(crc >> 24) ^ *data++];
+	}
+
+	return crc;
+}
+
+#ifdef CRC_USE_PCLMUL
+
+// Computes x^n mod P, which is used as a multiplier to fold 128-bit chunks forward by (n - 64) or n bits.
+static constexpr uint64_t xPowModPoly(unsigned int n)
+{
+	auto result = UINT32_C(1);
+	for (auto i = 0u; i < n; ++i) {
+		result = (result & UINT32_C(0x80000000)) ? ((result << 1) ^ CRC32_POLY) : (result << 1);
+	}
+	return result;
+}
+
+static const auto PCLMUL_MIN_SIZE = size_t(64);
+
+static inline __m128i foldChunk(__m128i chunk, __m128i multipliers)
+{
+	return _mm_xor_si128(
+		_mm_clmulepi64_si128(chunk, multipliers, 0x11),
+		_mm_clmulepi64_si128(chunk, multipliers, 0x00)
+	);
+}
+
+// The CRC is not reflected, so chunks are byte-reversed on load to have the first byte as the highest degree coefficients.
+static uint32_t crc32_0x04C11DB7Pclmul(const uint8_t* data, size_t dataSize, uint32_t crc)
+{
+	const auto byteSwapMask = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	const auto fold512 = _mm_set_epi64x(xPowModPoly(512 + 64), xPowModPoly(512));
+	const auto fold128 = _mm_set_epi64x(xPowModPoly(128 + 64), xPowModPoly(128));
+
+	const auto load = [&byteSwapMask](const uint8_t* p) {
+		return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), byteSwapMask);
+	};
+
+	// Initial value is applied by xoring it into the first four bytes of message.
+	auto x0 = _mm_xor_si128(load(data + 0x00), _mm_set_epi32(static_cast<int>(crc), 0, 0, 0));
+	auto x1 = load(data + 0x10);
+	auto x2 = load(data + 0x20);
+	auto x3 = load(data + 0x30);
+	data += 0x40;
+	dataSize -= 0x40;
+
+	while (dataSize >= 0x40) {
+		x0 = _mm_xor_si128(foldChunk(x0, fold512), load(data + 0x00));
+		x1 = _mm_xor_si128(foldChunk(x1, fold512), load(data + 0x10));
+		x2 = _mm_xor_si128(foldChunk(x2, fold512), load(data + 0x20));
+		x3 = _mm_xor_si128(foldChunk(x3, fold512), load(data + 0x30));
+		data += 0x40;
+		dataSize -= 0x40;
+	}
+
+	x1 = _mm_xor_si128(foldChunk(x0, fold128), x1);
+	x2 = _mm_xor_si128(foldChunk(x1, fold128), x2);
+	x3 = _mm_xor_si128(foldChunk(x2, fold128), x3);
+
+	// Remaining 128-bit value is congruent to the whole processed message, so CRC of it continues over the rest of data.
+	uint8_t folded[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(folded), _mm_shuffle_epi8(x3, byteSwapMask));
+
+	crc = crc32_0x04C11DB7Slicing(folded, sizeof(folded), 0);
+
+	return crc32_0x04C11DB7Slicing(data, dataSize, crc);
+}
+
+#endif
+
+uint32_t crc32_0x04C11DB7(const uint8_t* data, size_t dataSize, uint32_t initial)
+{
+#ifdef CRC_USE_PCLMUL
+	if (dataSize >= PCLMUL_MIN_SIZE) {
+		return crc32_0x04C11DB7Pclmul(data, dataSize, initial);
+	}
+#endif
+
+	return crc32_0x04C11DB7Slicing(data, dataSize, initial);
+}
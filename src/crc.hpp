@@ -7,10 +7,25 @@
 #include <iterator>
 #include <numeric>
 
+#include <type_traits>
+
 extern const std::array<uint32_t, 256> g_crc32_0x04C11DB7;
 
+struct Crc32SlicingTables
+{
+	static const auto SLICE_COUNT = 16u;
+
+	// Table k holds CRC of byte followed by k zero bytes, so table 0 is equal to g_crc32_0x04C11DB7.
+	uint32_t table[SLICE_COUNT][256];
+};
+
+extern const Crc32SlicingTables g_crc32_0x04C11DB7_slicing;
+
+// Uses carry-less multiply folding for long buffers if available and slicing-by-16 otherwise.
+uint32_t crc32_0x04C11DB7(const uint8_t* data, size_t dataSize, uint32_t initial);
+
 template<typename InputIt>
-inline uint32_t crc32_0x04C11DB7(InputIt first, InputIt last, uint32_t initial)
+inline uint32_t crc32_0x04C11DB7Generic(InputIt first, InputIt last, uint32_t initial, std::false_type)
 {
 	typedef typename std::iterator_traits<InputIt>::value_type ValueType;
 
@@ -24,3 +39,18 @@ inline uint32_t crc32_0x04C11DB7(InputIt first, InputIt last, uint32_t initial)
 		}
 	);
 }
+
+template<typename InputIt>
+inline uint32_t crc32_0x04C11DB7Generic(InputIt first, InputIt last, uint32_t initial, std::true_type)
+{
+	return crc32_0x04C11DB7(reinterpret_cast<const uint8_t*>(first), static_cast<size_t>(last - first), initial);
+}
+
+template<typename InputIt>
+inline uint32_t crc32_0x04C11DB7(InputIt first, InputIt last, uint32_t initial)
+{
+	typedef typename std::iterator_traits<InputIt>::value_type ValueType;
+	typedef std::integral_constant<bool, std::is_pointer<InputIt>::value && sizeof(ValueType) == 1> IsByteBuffer;
+
+	return crc32_0x04C11DB7Generic(first, last, initial, IsByteBuffer());
+}
@@ -1,5 +1,12 @@
 #include "crypto.hpp"
 
+#include <cstring>
+#include <numeric>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#	include <immintrin.h>
+#endif
+
 constexpr std::array<Salsa20Cipher::MatrixElement, 32> Salsa20Cipher::MATRIX = {{
 	{  4,  0, 12,  7 },
 	{  8,  4,  0,  9 },
@@ -34,3 +41,460 @@ constexpr std::array<Salsa20Cipher::MatrixElement, 32> Salsa20Cipher::MATRIX = {
 	{ 14, 13, 12, 13 },
 	{ 15, 14, 13, 18 },
 }};
+
+// Keystream of a register with width W is its bits read cyclically from the lowest one, so 8 bytes of it are W-bit copies
+// of the register placed side by side, after that the register is rotated right by (64 mod W).
+template<unsigned int W>
+struct KeyRegister
+{
+	static const auto MASK = (UINT64_C(1) << W) - 1;
+
+	static const auto REPEAT = (UINT64_C(1) << (0 * W)) | (UINT64_C(1) << (1 * W)) | (UINT64_C(1) << (2 * W)) | ((3 * W < 64) ? (UINT64_C(1) << ((3 * W) % 64)) : 0);
+
+	static uint64_t expand(uint64_t c)
+	{
+		return c * REPEAT;
+	}
+
+	template<unsigned int N>
+	static uint64_t rotate(uint64_t c)
+	{
+		return ((c >> (N % W)) | (c << (W - N % W))) & MASK;
+	}
+};
+
+typedef KeyRegister<17> KeyRegister0;
+typedef KeyRegister<19> KeyRegister1;
+typedef KeyRegister<23> KeyRegister2;
+typedef KeyRegister<29> KeyRegister3;
+
+#ifdef __AVX2__
+
+template<unsigned int W>
+struct KeyRegisterX4
+{
+	static __m256i expand(__m256i c)
+	{
+		auto result = _mm256_or_si256(c, _mm256_slli_epi64(c, W));
+		result = _mm256_or_si256(result, _mm256_slli_epi64(c, 2 * W));
+		if (3 * W < 64) {
+			result = _mm256_or_si256(result, _mm256_slli_epi64(c, (3 * W) % 64));
+		}
+		return result;
+	}
+
+	template<unsigned int N>
+	static __m256i rotate(__m256i c)
+	{
+		const auto mask = _mm256_set1_epi64x(static_cast<int64_t>(KeyRegister<W>::MASK));
+		return _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(c, N % W), _mm256_slli_epi64(c, W - N % W)), mask);
+	}
+
+	// Lane i starts at i-th 8 byte word of keystream.
+	static __m256i load(uint64_t c)
+	{
+		const auto c1 = KeyRegister<W>::template rotate<64>(c);
+		const auto c2 = KeyRegister<W>::template rotate<64>(c1);
+		const auto c3 = KeyRegister<W>::template rotate<64>(c2);
+		return _mm256_set_epi64x(static_cast<int64_t>(c3), static_cast<int64_t>(c2), static_cast<int64_t>(c1), static_cast<int64_t>(c));
+	}
+};
+
+#endif
+
+void Keyset::cryptBuffer(const uint8_t* in, uint8_t* out, size_t size, Key& c)
+{
+	static_assert(KEY_BITS0 == 17 && KEY_BITS1 == 19 && KEY_BITS2 == 23 && KEY_BITS3 == 29, "Unexpected key register widths");
+
+	uint64_t c0 = c[0], c1 = c[1], c2 = c[2], c3 = c[3];
+
+#ifdef __AVX2__
+	if (size >= 0x20) {
+		auto v0 = KeyRegisterX4<17>::load(c0);
+		auto v1 = KeyRegisterX4<19>::load(c1);
+		auto v2 = KeyRegisterX4<23>::load(c2);
+		auto v3 = KeyRegisterX4<29>::load(c3);
+
+		while (size >= 0x20) {
+			const auto keyStream = _mm256_xor_si256(
+				_mm256_xor_si256(KeyRegisterX4<17>::expand(v0), KeyRegisterX4<19>::expand(v1)),
+				_mm256_xor_si256(KeyRegisterX4<23>::expand(v2), KeyRegisterX4<29>::expand(v3))
+			);
+
+			const auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_xor_si256(data, keyStream));
+
+			v0 = KeyRegisterX4<17>::rotate<256>(v0);
+			v1 = KeyRegisterX4<19>::rotate<256>(v1);
+			v2 = KeyRegisterX4<23>::rotate<256>(v2);
+			v3 = KeyRegisterX4<29>::rotate<256>(v3);
+
+			in += 0x20;
+			out += 0x20;
+			size -= 0x20;
+		}
+
+		c0 = static_cast<uint64_t>(_mm256_extract_epi64(v0, 0));
+		c1 = static_cast<uint64_t>(_mm256_extract_epi64(v1, 0));
+		c2 = static_cast<uint64_t>(_mm256_extract_epi64(v2, 0));
+		c3 = static_cast<uint64_t>(_mm256_extract_epi64(v3, 0));
+	}
+#endif
+
+	while (size >= sizeof(uint64_t)) {
+		const auto keyStream = boost::endian::native_to_little(
+			KeyRegister0::expand(c0) ^ KeyRegister1::expand(c1) ^ KeyRegister2::expand(c2) ^ KeyRegister3::expand(c3)
+		);
+
+		uint64_t data;
+		std::memcpy(&data, in, sizeof(data));
+		data ^= keyStream;
+		std::memcpy(out, &data, sizeof(data));
+
+		c0 = KeyRegister0::rotate<64>(c0);
+		c1 = KeyRegister1::rotate<64>(c1);
+		c2 = KeyRegister2::rotate<64>(c2);
+		c3 = KeyRegister3::rotate<64>(c3);
+
+		in += sizeof(uint64_t);
+		out += sizeof(uint64_t);
+		size -= sizeof(uint64_t);
+	}
+
+	c = Key({{ static_cast<uint32_t>(c0), static_cast<uint32_t>(c1), static_cast<uint32_t>(c2), static_cast<uint32_t>(c3) }});
+
+	while (size-- > 0) {
+		*out++ = cryptByte(*in++, c);
+	}
+}
+
+#ifdef __AVX2__
+
+// Lane layout used for batches: each 32-bit lane is a separate stream, 4 bytes of it are two copies of register side by side.
+template<unsigned int W>
+struct KeyRegisterX8
+{
+	static __m256i expand(__m256i c)
+	{
+		return _mm256_or_si256(c, _mm256_slli_epi32(c, W));
+	}
+
+	static __m256i rotate(__m256i c)
+	{
+		const auto n = 32 % W;
+		const auto mask = _mm256_set1_epi32(static_cast<int>(KeyRegister<W>::MASK));
+		return _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi32(c, n), _mm256_slli_epi32(c, W - n)), mask);
+	}
+};
+
+static const auto BATCH_LANE_COUNT = 8u;
+
+static inline __m256i invXorShiftX8(__m256i x, uint32_t y)
+{
+	const auto poly = _mm256_set1_epi32(static_cast<int>(y));
+	for (auto i = 0u; i < sizeof(uint32_t) * CHAR_BIT; ++i) {
+		const auto upperBit = _mm256_srai_epi32(x, 31);
+		x = _mm256_xor_si256(_mm256_slli_epi32(x, 1), _mm256_and_si256(upperBit, poly));
+	}
+	return _mm256_xor_si256(x, _mm256_set1_epi32(-1));
+}
+
+// Afterwards row i holds 8 consecutive words of lane i instead of word i of all lanes.
+static inline void transposeX8(__m256i rows[BATCH_LANE_COUNT])
+{
+	const auto t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+	const auto t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+	const auto t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+	const auto t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+	const auto t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+	const auto t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+	const auto t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+	const auto t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+	const auto u0 = _mm256_unpacklo_epi64(t0, t2);
+	const auto u1 = _mm256_unpackhi_epi64(t0, t2);
+	const auto u2 = _mm256_unpacklo_epi64(t1, t3);
+	const auto u3 = _mm256_unpackhi_epi64(t1, t3);
+	const auto u4 = _mm256_unpacklo_epi64(t4, t6);
+	const auto u5 = _mm256_unpackhi_epi64(t4, t6);
+	const auto u6 = _mm256_unpacklo_epi64(t5, t7);
+	const auto u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+#endif
+
+void Keyset::cryptBatch(const CryptJob* jobs, size_t jobCount) const
+{
+	std::vector<Key> keys(jobCount);
+	std::vector<size_t> processedSizes(jobCount, 0);
+
+#ifdef __AVX2__
+	// Jobs are grouped by size, so lanes of a group stay busy for most of the common length.
+	std::vector<size_t> order(jobCount);
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::sort(order.begin(), order.end(), [jobs](size_t a, size_t b) { return jobs[a].size < jobs[b].size; });
+
+	auto first = size_t(0);
+	for (; first + BATCH_LANE_COUNT <= jobCount; first += BATCH_LANE_COUNT) {
+		const auto* lanes = &order[first];
+
+		alignas(32) uint32_t state[4][BATCH_LANE_COUNT];
+		for (auto i = 0u; i < BATCH_LANE_COUNT; ++i) {
+			state[0][i] = (~m_magicCrc) ^ jobs[lanes[i]].seed;
+		}
+
+		// Same key schedule as in computeKey() but for all lanes at once.
+		const auto c0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[0]));
+		const auto c1 = invXorShiftX8(c0, m_key[0]);
+		const auto c2 = invXorShiftX8(c1, m_key[1]);
+		const auto c3 = invXorShiftX8(c2, m_key[2]);
+		const auto c4 = invXorShiftX8(c3, m_key[3]);
+
+		auto v0 = _mm256_and_si256(c1, _mm256_set1_epi32((1 << KEY_BITS0) - 1));
+		auto v1 = _mm256_and_si256(c2, _mm256_set1_epi32((1 << KEY_BITS1) - 1));
+		auto v2 = _mm256_and_si256(c3, _mm256_set1_epi32((1 << KEY_BITS2) - 1));
+		auto v3 = _mm256_and_si256(c4, _mm256_set1_epi32((1 << KEY_BITS3) - 1));
+
+		const auto blockSize = BATCH_LANE_COUNT * sizeof(uint32_t);
+		const auto commonSize = alignDown(jobs[lanes[0]].size, blockSize);
+
+		for (auto offset = size_t(0); offset < commonSize; offset += blockSize) {
+			__m256i rows[BATCH_LANE_COUNT];
+			for (auto& row: rows) {
+				row = _mm256_xor_si256(
+					_mm256_xor_si256(KeyRegisterX8<17>::expand(v0), KeyRegisterX8<19>::expand(v1)),
+					_mm256_xor_si256(KeyRegisterX8<23>::expand(v2), KeyRegisterX8<29>::expand(v3))
+				);
+
+				v0 = KeyRegisterX8<17>::rotate(v0);
+				v1 = KeyRegisterX8<19>::rotate(v1);
+				v2 = KeyRegisterX8<23>::rotate(v2);
+				v3 = KeyRegisterX8<29>::rotate(v3);
+			}
+
+			transposeX8(rows);
+
+			for (auto i = 0u; i < BATCH_LANE_COUNT; ++i) {
+				const auto& job = jobs[lanes[i]];
+
+				const auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(job.in + offset));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(job.out + offset), _mm256_xor_si256(data, rows[i]));
+			}
+		}
+
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[0]), v0);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[1]), v1);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[2]), v2);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(state[3]), v3);
+
+		// Remaining bytes of longer streams are finished by the single stream kernel below.
+		for (auto i = 0u; i < BATCH_LANE_COUNT; ++i) {
+			keys[lanes[i]] = Key({{ state[0][i], state[1][i], state[2][i], state[3][i] }});
+			processedSizes[lanes[i]] = commonSize;
+		}
+	}
+
+	for (; first < jobCount; ++first) {
+		keys[order[first]] = computeKey(jobs[order[first]].seed);
+	}
+#else
+	for (auto i = 0u; i < jobCount; ++i) {
+		keys[i] = computeKey(jobs[i].seed);
+	}
+#endif
+
+	for (auto i = 0u; i < jobCount; ++i) {
+		const auto& job = jobs[i];
+		const auto processedSize = processedSizes[i];
+		cryptBuffer(job.in + processedSize, job.out + processedSize, job.size - processedSize, keys[i]);
+	}
+}
+
+// Wide Salsa20 kernels keep word i of N consecutive blocks in lanes of vector x[i], so quarter-rounds are plain lane-wise
+// operations, and state is transposed back to per-block layout right before it is xored with data.
+#define SALSA20_QUARTER_ROUND(a, b, c, d) \
+	do { \
+		x[b] = XOR(x[b], ROTATE(ADD(x[a], x[d]), 7)); \
+		x[c] = XOR(x[c], ROTATE(ADD(x[b], x[a]), 9)); \
+		x[d] = XOR(x[d], ROTATE(ADD(x[c], x[b]), 13)); \
+		x[a] = XOR(x[a], ROTATE(ADD(x[d], x[c]), 18)); \
+	} while (0)
+
+#define SALSA20_DOUBLE_ROUNDS() \
+	do { \
+		for (auto round = 20; round > 0; round -= 2) { \
+			SALSA20_QUARTER_ROUND(0, 4, 8, 12); \
+			SALSA20_QUARTER_ROUND(5, 9, 13, 1); \
+			SALSA20_QUARTER_ROUND(10, 14, 2, 6); \
+			SALSA20_QUARTER_ROUND(15, 3, 7, 11); \
+			SALSA20_QUARTER_ROUND(0, 1, 2, 3); \
+			SALSA20_QUARTER_ROUND(5, 6, 7, 4); \
+			SALSA20_QUARTER_ROUND(10, 11, 8, 9); \
+			SALSA20_QUARTER_ROUND(15, 12, 13, 14); \
+		} \
+	} while (0)
+
+static inline void advanceSalsa20Counter(uint32_t& low, uint32_t& high, uint32_t count)
+{
+	const auto counter = ((static_cast<uint64_t>(high) << 32) | low) + count;
+	low = static_cast<uint32_t>(counter);
+	high = static_cast<uint32_t>(counter >> 32);
+}
+
+#if defined(__SSE2__)
+
+static inline void transposeX4(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+	const auto t0 = _mm_unpacklo_epi32(a, b);
+	const auto t1 = _mm_unpacklo_epi32(c, d);
+	const auto t2 = _mm_unpackhi_epi32(a, b);
+	const auto t3 = _mm_unpackhi_epi32(c, d);
+
+	a = _mm_unpacklo_epi64(t0, t1);
+	b = _mm_unpackhi_epi64(t0, t1);
+	c = _mm_unpacklo_epi64(t2, t3);
+	d = _mm_unpackhi_epi64(t2, t3);
+}
+
+static void processSalsa20BlocksX4(std::array<uint32_t, Salsa20Cipher::STATE_SIZE>& state, const uint8_t* in, uint8_t* out)
+{
+#define ADD(a, b) _mm_add_epi32((a), (b))
+#define XOR(a, b) _mm_xor_si128((a), (b))
+#define ROTATE(v, n) _mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+
+	__m128i initial[Salsa20Cipher::STATE_SIZE];
+	for (auto i = 0u; i < Salsa20Cipher::STATE_SIZE; ++i) {
+		initial[i] = _mm_set1_epi32(static_cast<int>(state[i]));
+	}
+
+	uint32_t counterLow[4], counterHigh[4];
+	for (auto i = 0u; i < 4; ++i) {
+		counterLow[i] = state[8];
+		counterHigh[i] = state[9];
+		advanceSalsa20Counter(counterLow[i], counterHigh[i], i);
+	}
+	initial[8] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counterLow));
+	initial[9] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counterHigh));
+
+	__m128i x[Salsa20Cipher::STATE_SIZE];
+	std::copy(initial, initial + Salsa20Cipher::STATE_SIZE, x);
+
+	SALSA20_DOUBLE_ROUNDS();
+
+	for (auto i = 0u; i < Salsa20Cipher::STATE_SIZE; ++i) {
+		x[i] = _mm_add_epi32(x[i], initial[i]);
+	}
+
+	// Each group of 4 words is transposed, so vector j of a group holds its words for block j.
+	for (auto i = 0u; i < Salsa20Cipher::STATE_SIZE; i += 4) {
+		transposeX4(x[i + 0], x[i + 1], x[i + 2], x[i + 3]);
+
+		for (auto j = 0u; j < 4; ++j) {
+			const auto offset = j * Salsa20Cipher::BLOCK_SIZE + i * sizeof(uint32_t);
+			const auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + offset));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + offset), _mm_xor_si128(data, x[i + j]));
+		}
+	}
+
+	advanceSalsa20Counter(state[8], state[9], 4);
+
+#undef ROTATE
+#undef XOR
+#undef ADD
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+static void processSalsa20BlocksX8(std::array<uint32_t, Salsa20Cipher::STATE_SIZE>& state, const uint8_t* in, uint8_t* out)
+{
+#define ADD(a, b) _mm256_add_epi32((a), (b))
+#define XOR(a, b) _mm256_xor_si256((a), (b))
+#define ROTATE(v, n) _mm256_or_si256(_mm256_slli_epi32((v), (n)), _mm256_srli_epi32((v), 32 - (n)))
+
+	__m256i initial[Salsa20Cipher::STATE_SIZE];
+	for (auto i = 0u; i < Salsa20Cipher::STATE_SIZE; ++i) {
+		initial[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+	}
+
+	uint32_t counterLow[8], counterHigh[8];
+	for (auto i = 0u; i < 8; ++i) {
+		counterLow[i] = state[8];
+		counterHigh[i] = state[9];
+		advanceSalsa20Counter(counterLow[i], counterHigh[i], i);
+	}
+	initial[8] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counterLow));
+	initial[9] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counterHigh));
+
+	__m256i x[Salsa20Cipher::STATE_SIZE];
+	std::copy(initial, initial + Salsa20Cipher::STATE_SIZE, x);
+
+	SALSA20_DOUBLE_ROUNDS();
+
+	for (auto i = 0u; i < Salsa20Cipher::STATE_SIZE; ++i) {
+		x[i] = _mm256_add_epi32(x[i], initial[i]);
+	}
+
+	// Transposition inside 128-bit halves gives words of blocks 0-3 in low halves and of blocks 4-7 in high ones.
+	for (auto i = 0u; i < Salsa20Cipher::STATE_SIZE; i += 4) {
+		const auto t0 = _mm256_unpacklo_epi32(x[i + 0], x[i + 1]);
+		const auto t1 = _mm256_unpacklo_epi32(x[i + 2], x[i + 3]);
+		const auto t2 = _mm256_unpackhi_epi32(x[i + 0], x[i + 1]);
+		const auto t3 = _mm256_unpackhi_epi32(x[i + 2], x[i + 3]);
+
+		const __m256i words[4] = {
+			_mm256_unpacklo_epi64(t0, t1),
+			_mm256_unpackhi_epi64(t0, t1),
+			_mm256_unpacklo_epi64(t2, t3),
+			_mm256_unpackhi_epi64(t2, t3),
+		};
+
+		for (auto j = 0u; j < 4; ++j) {
+			const auto lowOffset = j * Salsa20Cipher::BLOCK_SIZE + i * sizeof(uint32_t);
+			const auto highOffset = lowOffset + 4 * Salsa20Cipher::BLOCK_SIZE;
+
+			const auto lowData = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + lowOffset));
+			const auto highData = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + highOffset));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + lowOffset), _mm_xor_si128(lowData, _mm256_castsi256_si128(words[j])));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + highOffset), _mm_xor_si128(highData, _mm256_extracti128_si256(words[j], 1)));
+		}
+	}
+
+	advanceSalsa20Counter(state[8], state[9], 8);
+
+#undef ROTATE
+#undef XOR
+#undef ADD
+}
+
+#endif
+
+size_t Salsa20Cipher::processBlocksWide(State& state, const uint8_t* in, uint8_t* out, size_t blockCount)
+{
+	auto processedCount = size_t(0);
+
+#if defined(__AVX2__)
+	for (; blockCount - processedCount >= 8; processedCount += 8) {
+		processSalsa20BlocksX8(state, in + processedCount * BLOCK_SIZE, out + processedCount * BLOCK_SIZE);
+	}
+#endif
+
+#if defined(__SSE2__)
+	for (; blockCount - processedCount >= 4; processedCount += 4) {
+		processSalsa20BlocksX4(state, in + processedCount * BLOCK_SIZE, out + processedCount * BLOCK_SIZE);
+	}
+#endif
+
+	return processedCount;
+}
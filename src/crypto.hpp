@@ -7,6 +7,7 @@
 #include <array>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include <boost/endian/conversion.hpp>
 
@@ -14,16 +15,25 @@ class Keyset
 {
 public:
 	typedef std::array<uint32_t, 4> Key;
+
+	struct CryptJob
+	{
+		const uint8_t* in;
+		uint8_t* out;
+		size_t size;
+		uint32_t seed;
+	};
 	
 	Keyset(const std::string& magic, const Key& key)
 		: m_magic(magic)
 		, m_key(key)
+		, m_magicCrc(crc32_0x04C11DB7(magic.begin(), magic.end(), 0))
 	{
 	}
 
 	const Key computeKey(uint32_t seed) const
 	{
-		const auto c0 = (~crc32_0x04C11DB7(m_magic.begin(), m_magic.end(), 0)) ^ seed;
+		const auto c0 = (~m_magicCrc) ^ seed;
 
 		const auto c1 = invXorShift(c0, m_key[0]);
 		const auto c2 = invXorShift(c1, m_key[1]);
@@ -47,23 +57,45 @@ public:
 	>
 	void cryptBytes(InputIt srcFirst, InputIt srcLast, OutputIt dstFirst, uint32_t seed) const
 	{
-		typedef typename std::iterator_traits<InputIt>::value_type ValueType;
+		typedef std::integral_constant<bool, std::is_pointer<InputIt>::value && std::is_pointer<OutputIt>::value> IsBuffer;
 
 		auto c = computeKey(seed);
 
-		std::transform(
-			srcFirst, srcLast, dstFirst,
-			[&c](const ValueType in) {
-				const ValueType out = (((c[0] ^ c[1]) ^ in) ^ (c[2] ^ c[3])) & UINT8_C(0xFF);
+		cryptBytesInternal(srcFirst, srcLast, dstFirst, c, IsBuffer());
+	}
+
+	// Same as cryptBytes() but data starts at the given byte offset of keystream.
+	template<
+		typename InputIt, typename OutputIt,
+		typename = typename std::enable_if_t<
+			std::is_same<typename std::iterator_traits<InputIt>::value_type, uint8_t>::value &&
+			std::is_same<typename std::iterator_traits<OutputIt>::value_type, uint8_t>::value
+		>
+	>
+	void cryptBytesAt(uint64_t offset, InputIt srcFirst, InputIt srcLast, OutputIt dstFirst, uint32_t seed) const
+	{
+		typedef std::integral_constant<bool, std::is_pointer<InputIt>::value && std::is_pointer<OutputIt>::value> IsBuffer;
 
-				c[0] = ((rotateLeft(c[0], 9) & UINT32_C(0x1FE00)) | (c[0] >> 8));
-				c[1] = ((rotateLeft(c[1], 11) & UINT32_C(0x7F800)) | (c[1] >> 8));
-				c[2] = ((rotateLeft(c[2], 15) & UINT32_C(0x7F8000)) | (c[2] >> 8));
-				c[3] = ((rotateLeft(c[3], 21) & UINT32_C(0x1FE00000)) | (c[3] >> 8));
+		auto c = seekKey(computeKey(seed), offset);
 
-				return out;
-			}
-		);
+		cryptBytesInternal(srcFirst, srcLast, dstFirst, c, IsBuffer());
+	}
+
+	// Processes many independent buffers at once, streams of similar size are interleaved in SIMD lanes if available.
+	void cryptBatch(const CryptJob* jobs, size_t jobCount) const;
+
+	// Processes contiguous buffer (in-place is allowed) and leaves key in state for the byte following it.
+	static void cryptBuffer(const uint8_t* in, uint8_t* out, size_t size, Key& c);
+
+	// Registers are rotated by 8 bits per byte, so state at any offset is a single rotation of each register.
+	static Key seekKey(const Key& c, uint64_t offset)
+	{
+		return Key({{
+			rotateKeyRegister(c[0], KEY_BITS0, offset),
+			rotateKeyRegister(c[1], KEY_BITS1, offset),
+			rotateKeyRegister(c[2], KEY_BITS2, offset),
+			rotateKeyRegister(c[3], KEY_BITS3, offset),
+		}});
 	}
 
 	template<typename InputIt, typename OutputIt>
@@ -84,16 +116,58 @@ public:
 	auto key(size_t i) const { return m_key[i]; }
 
 private:
+	// Each register is rotated right by 8 bits within its width after every byte.
+	static const auto KEY_BITS0 = 17u;
+	static const auto KEY_BITS1 = 19u;
+	static const auto KEY_BITS2 = 23u;
+	static const auto KEY_BITS3 = 29u;
+
+	static uint32_t rotateKeyRegister(uint32_t x, unsigned int bitCount, uint64_t byteCount)
+	{
+		const auto n = static_cast<unsigned int>(((byteCount % bitCount) * CHAR_BIT) % bitCount);
+		if (n == 0) {
+			return x;
+		}
+		const auto mask = (UINT32_C(1) << bitCount) - 1;
+		return ((x >> n) | (x << (bitCount - n))) & mask;
+	}
+
+	static uint8_t cryptByte(uint8_t in, Key& c)
+	{
+		const uint8_t out = (((c[0] ^ c[1]) ^ in) ^ (c[2] ^ c[3])) & UINT8_C(0xFF);
+
+		c[0] = ((rotateLeft(c[0], 9) & UINT32_C(0x1FE00)) | (c[0] >> 8));
+		c[1] = ((rotateLeft(c[1], 11) & UINT32_C(0x7F800)) | (c[1] >> 8));
+		c[2] = ((rotateLeft(c[2], 15) & UINT32_C(0x7F8000)) | (c[2] >> 8));
+		c[3] = ((rotateLeft(c[3], 21) & UINT32_C(0x1FE00000)) | (c[3] >> 8));
+
+		return out;
+	}
+
+	template<typename InputIt, typename OutputIt>
+	static void cryptBytesInternal(InputIt srcFirst, InputIt srcLast, OutputIt dstFirst, Key& c, std::false_type)
+	{
+		std::transform(
+			srcFirst, srcLast, dstFirst,
+			[&c](const uint8_t in) {
+				return cryptByte(in, c);
+			}
+		);
+	}
+
+	template<typename InputIt, typename OutputIt>
+	static void cryptBytesInternal(InputIt srcFirst, InputIt srcLast, OutputIt dstFirst, Key& c, std::true_type)
+	{
+		cryptBuffer(srcFirst, dstFirst, static_cast<size_t>(srcLast - srcFirst), c);
+	}
+
 	static uint32_t xorShift(uint32_t x, uint32_t y)
 	{
 		auto result = x;
 		const auto count = sizeof(x) * CHAR_BIT;
 		for (auto i = 0u; i < count; ++i) {
-			const auto hasUpperBit = (result & UINT32_C(0x80000000)) != 0;
-			result <<= 1;
-			if (hasUpperBit) {
-				result ^= y;
-			}
+			const auto upperBitMask = UINT32_C(0) - (result >> 31);
+			result = (result << 1) ^ (y & upperBitMask);
 		}
 		return result;
 	}
@@ -157,6 +231,7 @@ private:
 
 	const std::string m_magic;
 	const Key m_key;
+	const uint32_t m_magicCrc;
 };
 
 class Salsa20Cipher
@@ -232,10 +307,27 @@ public:
 		}
 	}
 
+	// Block counter lives in state words 8 and 9, setting it allows to start processing from any block of a stream.
+	void setCounter(uint64_t counter)
+	{
+		m_state[8] = static_cast<uint32_t>(counter);
+		m_state[9] = static_cast<uint32_t>(counter >> 32);
+	}
+
+	uint64_t counter() const
+	{
+		return (static_cast<uint64_t>(m_state[9]) << 32) | m_state[8];
+	}
+
 	void processBlocks(const uint8_t* in, uint8_t* out, size_t blockCount)
 	{
 		uint8_t keyStream[BLOCK_SIZE];
 
+		const auto wideBlockCount = processBlocksWide(m_state, in, out, blockCount);
+		in += wideBlockCount * BLOCK_SIZE;
+		out += wideBlockCount * BLOCK_SIZE;
+		blockCount -= wideBlockCount;
+
 		for (auto i = 0u; i < blockCount; ++i) {
 			generateKeyStream(keyStream);
 
@@ -249,6 +341,11 @@ public:
 	{
 		uint8_t keyStream[BLOCK_SIZE];
 
+		const auto wideBlockCount = processBlocksWide(m_state, in, out, byteCount / BLOCK_SIZE);
+		in += wideBlockCount * BLOCK_SIZE;
+		out += wideBlockCount * BLOCK_SIZE;
+		byteCount -= wideBlockCount * BLOCK_SIZE;
+
 		while (byteCount != 0) {
 			generateKeyStream(keyStream);
 
@@ -269,6 +366,12 @@ private:
 	
 	static const std::array<MatrixElement, 32> MATRIX;
 
+	typedef std::array<uint32_t, STATE_SIZE> State;
+
+	// Processes several blocks at once with SIMD kernels and advances the counter, returns number of processed blocks
+	// which is a multiple of kernel width (or zero if there is no kernel), rest of blocks is left for the reference code below.
+	static size_t processBlocksWide(State& state, const uint8_t* in, uint8_t* out, size_t blockCount);
+
 	void generateKeyStream(uint8_t keyStream[BLOCK_SIZE])
 	{
 		std::array<uint32_t, STATE_SIZE> newState = m_state;
@@ -0,0 +1,268 @@
+#include "entry_filter.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+#include <boost/algorithm/string.hpp>
+
+static inline char toUpper(char c)
+{
+	return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+}
+
+static bool startsWithNoCase(const char* str, size_t strLength, const std::string& prefix)
+{
+	if (strLength < prefix.size()) {
+		return false;
+	}
+
+	for (auto i = size_t(0); i < prefix.size(); ++i) {
+		if (toUpper(str[i]) != prefix[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool EntryFilter::empty() const
+{
+	return m_includes.empty() && m_excludes.empty() && m_extensions.empty() && m_root.empty() && m_paths.empty();
+}
+
+void EntryFilter::addInclude(const std::string& pattern)
+{
+	m_includes.push_back(normalizePath(pattern));
+}
+
+void EntryFilter::addExclude(const std::string& pattern)
+{
+	m_excludes.push_back(normalizePath(pattern));
+}
+
+void EntryFilter::addExtension(const std::string& extension)
+{
+	auto normalizedExtension = boost::algorithm::to_upper_copy(boost::algorithm::trim_copy(extension));
+	if (normalizedExtension.empty()) {
+		return;
+	}
+	if (normalizedExtension[0] != '.') {
+		normalizedExtension.insert(normalizedExtension.begin(), '.');
+	}
+
+	m_extensions.push_back(normalizedExtension);
+}
+
+void EntryFilter::setRoot(const std::string& directory)
+{
+	m_root = normalizePath(directory);
+	if (!m_root.empty() && m_root.back() != '/') {
+		m_root += '/';
+	}
+}
+
+void EntryFilter::addPath(const std::string& path)
+{
+	const auto normalizedPath = normalizePath(path);
+	if (!normalizedPath.empty() && m_paths.insert(normalizedPath).second) {
+		m_listedPaths.push_back(normalizeSeparators(path));
+	}
+}
+
+bool EntryFilter::loadList(const std::string& filePath)
+{
+	std::ifstream file(filePath);
+	if (!file) {
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line)) {
+		boost::algorithm::trim(line);
+		if (line.empty()) {
+			continue;
+		}
+
+		addPath(line);
+	}
+
+	return true;
+}
+
+bool EntryFilter::selectsListedPathsOnly() const
+{
+	return !m_paths.empty() && m_includes.empty() && m_excludes.empty() && m_extensions.empty() && m_root.empty();
+}
+
+bool EntryFilter::prepare(const PathTable& table)
+{
+	m_extIndices.clear();
+	m_rootFirstIndex = m_rootLastIndex = 0;
+
+	if (!m_extensions.empty()) {
+		const auto& extensions = table.extensions();
+
+		m_extIndices.resize(extensions.size());
+		for (auto i = 0u; i < extensions.size(); ++i) {
+			const char* value;
+			uint32_t length;
+			if (!extensions.get(i, value, length)) {
+				continue;
+			}
+
+			std::string extension(value, length);
+			boost::algorithm::to_upper(extension);
+			m_extIndices[i] = std::find(m_extensions.begin(), m_extensions.end(), extension) != m_extensions.end();
+		}
+	}
+
+	if (!m_root.empty()) {
+		const auto rootEntry = std::find_if(table.begin(), table.end(), [this, &table](const PathTable::Entry& entry) {
+			return entry.key.isDirectory() && entry.pathLength == m_root.size() && startsWithNoCase(table.pathData(entry), entry.pathLength, m_root);
+		});
+		if (rootEntry == table.end()) {
+			return false;
+		}
+
+		// Table lists contents of a directory right after it, so the subtree is a contiguous range.
+		m_rootFirstIndex = m_rootLastIndex = static_cast<size_t>(rootEntry - table.begin()) + 1;
+		while (m_rootLastIndex < table.size()) {
+			const auto& entry = table[m_rootLastIndex];
+			if (!startsWithNoCase(table.pathData(entry), entry.pathLength, m_root)) {
+				break;
+			}
+			++m_rootLastIndex;
+		}
+	}
+
+	return true;
+}
+
+bool EntryFilter::matches(const PathTable& table, size_t entryIndex) const
+{
+	const auto& entry = table[entryIndex];
+	if (entry.key.isDirectory()) {
+		return false;
+	}
+
+	if (!m_root.empty() && (entryIndex < m_rootFirstIndex || entryIndex >= m_rootLastIndex)) {
+		return false;
+	}
+
+	if (!m_extensions.empty()) {
+		const auto extIndex = entry.key.extIndex();
+		if (!entry.key.isFile() || extIndex >= m_extIndices.size() || !m_extIndices[extIndex]) {
+			return false;
+		}
+	}
+
+	const auto* path = table.pathData(entry);
+	const auto pathLength = static_cast<size_t>(entry.pathLength);
+
+	const auto matchesPattern = [path, pathLength](const std::string& pattern) {
+		return matchGlob(pattern.c_str(), pattern.size(), path, pathLength);
+	};
+	if (!m_includes.empty() && std::none_of(m_includes.begin(), m_includes.end(), matchesPattern)) {
+		return false;
+	}
+	if (std::any_of(m_excludes.begin(), m_excludes.end(), matchesPattern)) {
+		return false;
+	}
+
+	if (!m_paths.empty()) {
+		std::string upperPath(path, pathLength);
+		boost::algorithm::to_upper(upperPath);
+		if (m_paths.find(upperPath) == m_paths.end()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool EntryFilter::matchGlob(const char* pattern, size_t patternLength, const char* path, size_t pathLength)
+{
+	// Pattern is applied token by token to the set of path prefixes it can match so far, so time is bounded by pattern length
+	// times path length whatever the stars are.
+	uint8_t localRows[2 * LOCAL_GLOB_ROW_SIZE];
+	std::vector<uint8_t> heapRows;
+	auto* rows = localRows;
+	if (pathLength + 1 > LOCAL_GLOB_ROW_SIZE) {
+		heapRows.resize(2 * (pathLength + 1));
+		rows = heapRows.data();
+	}
+	auto* cur = rows;
+	auto* next = rows + pathLength + 1;
+
+	std::fill(cur, cur + pathLength + 1, 0);
+	cur[0] = 1;
+
+	for (auto p = size_t(0); p < patternLength; ) {
+		if (pattern[p] == '*') {
+			auto starCount = size_t(0);
+			while (p < patternLength && pattern[p] == '*') {
+				++p;
+				++starCount;
+			}
+			const auto crossesDirectories = starCount > 1;
+
+			if (crossesDirectories && p < patternLength && pattern[p] == '/') {
+				// "**/" matches nothing or any sequence of characters which ends with a separator.
+				++p;
+				auto reached = false;
+				for (auto s = size_t(0); s <= pathLength; ++s) {
+					next[s] = cur[s] || (reached && path[s - 1] == '/');
+					reached = reached || cur[s];
+				}
+			} else {
+				next[0] = cur[0];
+				for (auto s = size_t(1); s <= pathLength; ++s) {
+					next[s] = cur[s] || (next[s - 1] && (crossesDirectories || path[s - 1] != '/'));
+				}
+			}
+		} else {
+			const auto c = pattern[p++];
+
+			next[0] = 0;
+			for (auto s = size_t(1); s <= pathLength; ++s) {
+				const auto matched = (c == '?') ? (path[s - 1] != '/') : (toUpper(c) == toUpper(path[s - 1]));
+				next[s] = cur[s - 1] && matched;
+			}
+		}
+
+		std::swap(cur, next);
+		if (std::find(cur, cur + pathLength + 1, 1) == cur + pathLength + 1) {
+			return false;
+		}
+	}
+
+	return cur[pathLength] != 0;
+}
+
+std::string EntryFilter::normalizeSeparators(const std::string& path)
+{
+	std::string result;
+	result.reserve(path.size());
+
+	// Separators are unified and collapsed, leading ones are dropped since paths in volumes are relative.
+	for (auto c: boost::algorithm::trim_copy(path)) {
+		if (c == '\\') {
+			c = '/';
+		}
+		if (c == '/' && (result.empty() || result.back() == '/')) {
+			continue;
+		}
+		result += c;
+	}
+
+	return result;
+}
+
+std::string EntryFilter::normalizePath(const std::string& path)
+{
+	auto result = normalizeSeparators(path);
+	std::transform(result.begin(), result.end(), result.begin(), toUpper);
+
+	return result;
+}
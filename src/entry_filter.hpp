@@ -0,0 +1,71 @@
+#pragma once
+
+#include "path_table.hpp"
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Selects files of a volume for unpacking by globs, extensions, a subtree and an explicit list of paths. A file is selected
+// if it passes every criterion which is set, i.e. it matches some include glob, no exclude glob, has one of the extensions,
+// lies under the subtree root and is listed. Matching is case-insensitive and works on the path table only, so no node data
+// is touched.
+//
+// Globs are matched against full paths: '?' matches a single character and '*' any sequence of characters within a path
+// component, '**' matches across components and "**/" also matches no directory at all.
+class EntryFilter
+{
+public:
+	EntryFilter()
+		: m_rootFirstIndex(0)
+		, m_rootLastIndex(0)
+	{
+	}
+
+	bool empty() const;
+
+	void addInclude(const std::string& pattern);
+	void addExclude(const std::string& pattern);
+
+	// Leading dot is optional.
+	void addExtension(const std::string& extension);
+
+	void setRoot(const std::string& directory);
+
+	void addPath(const std::string& path);
+	// Paths are listed one per line, empty lines are skipped.
+	bool loadList(const std::string& filePath);
+
+	// True if the explicit list of paths is the only criterion, then files can be looked up by their paths instead of
+	// matching the whole table.
+	bool selectsListedPathsOnly() const;
+	// Listed paths with unified separators in their original case, each one is kept once.
+	const std::vector<std::string>& listedPaths() const { return m_listedPaths; }
+
+	// Resolves extensions and the subtree root against the table, it has to be called before entries of the table are
+	// matched. Returns false if the subtree root does not exist.
+	bool prepare(const PathTable& table);
+
+	bool matches(const PathTable& table, size_t entryIndex) const;
+
+	static bool matchGlob(const char* pattern, size_t patternLength, const char* path, size_t pathLength);
+
+private:
+	// Rows of the glob matcher for paths up to this length are kept on the stack.
+	static const auto LOCAL_GLOB_ROW_SIZE = size_t(0x200);
+
+	static std::string normalizeSeparators(const std::string& path);
+	static std::string normalizePath(const std::string& path);
+
+	std::vector<std::string> m_includes;
+	std::vector<std::string> m_excludes;
+	std::vector<std::string> m_extensions;
+	std::string m_root;
+	std::unordered_set<std::string> m_paths;
+	std::vector<std::string> m_listedPaths;
+
+	// Set by prepare().
+	std::vector<bool> m_extIndices;
+	size_t m_rootFirstIndex;
+	size_t m_rootLastIndex;
+};
@@ -0,0 +1,257 @@
+#include "entry_lister.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/algorithm/string.hpp>
+
+bool EntryLister::list(std::ostream& stream, const EntryFilter* filter) const
+{
+	const auto& table = m_volume.pathTable();
+
+	std::vector<uint32_t> fileEntryIndices;
+	std::vector<NodeKey> nodeKeys;
+	for (auto i = size_t(0); i < table.size(); ++i) {
+		const auto& entry = table[i];
+		if (!entry.key.isDirectory() && (!filter || filter->matches(table, i))) {
+			fileEntryIndices.push_back(static_cast<uint32_t>(i));
+			nodeKeys.emplace_back(entry.key.linkIndex());
+		}
+	}
+	std::vector<unsigned int> nodeIndices(nodeKeys.size());
+	m_volume.findNodes(nodeKeys.data(), nodeKeys.size(), nodeIndices.data());
+
+	std::string out;
+	out.reserve(OUTPUT_BUFFER_SIZE + 0x1000);
+
+	const auto flushIfFull = [&stream, &out]() {
+		if (out.size() >= OUTPUT_BUFFER_SIZE) {
+			stream.write(out.data(), static_cast<std::streamsize>(out.size()));
+			out.clear();
+		}
+	};
+
+	appendHeader(out);
+
+	// Files and directories at the top level are summed into the root record.
+	std::vector<Aggregate> directoryAggregates(m_listDirectories ? table.size() : 0, Aggregate{ 0, 0, 0 });
+	Aggregate rootAggregate = { 0, 0, 0 };
+	Aggregate totals = { 0, 0, 0 };
+	auto missingCount = size_t(0);
+
+	for (auto i = size_t(0); i < fileEntryIndices.size(); ++i) {
+		const auto& entry = table[fileEntryIndices[i]];
+		if (nodeIndices[i] == NodeBTree::INVALID_INDEX) {
+			std::cerr << "Cannot find node of file: " << table.path(entry) << std::endl;
+			++missingCount;
+			continue;
+		}
+
+		const auto& nodeKey = nodeKeys[i];
+
+		if (m_listFiles) {
+			appendFile(out, table.pathData(entry), entry.pathLength, nodeKey);
+			flushIfFull();
+		}
+
+		if (m_listDirectories) {
+			auto& aggregate = (entry.parentIndex != PathTable::NO_PARENT) ? directoryAggregates[entry.parentIndex] : rootAggregate;
+			++aggregate.fileCount;
+			aggregate.size1 += nodeKey.size1();
+			aggregate.size2 += nodeKey.size2();
+		}
+
+		++totals.fileCount;
+		totals.size1 += nodeKey.size1();
+		totals.size2 += nodeKey.size2();
+	}
+
+	if (m_listDirectories) {
+		// Contents of a directory always follow it in the table, so a backward pass sums subdirectories into their parents.
+		for (auto i = table.size(); i-- > 0; ) {
+			const auto& entry = table[i];
+			if (entry.key.isDirectory()) {
+				auto& parentAggregate = (entry.parentIndex != PathTable::NO_PARENT) ? directoryAggregates[entry.parentIndex] : rootAggregate;
+				parentAggregate.fileCount += directoryAggregates[i].fileCount;
+				parentAggregate.size1 += directoryAggregates[i].size1;
+				parentAggregate.size2 += directoryAggregates[i].size2;
+			}
+		}
+
+		// Root has an empty path, so it is told apart from the totals record.
+		if (!filter || rootAggregate.fileCount != 0) {
+			appendAggregate(out, "", 0, rootAggregate);
+		}
+
+		for (auto i = size_t(0); i < table.size(); ++i) {
+			const auto& entry = table[i];
+			// Directories without any selected file are left out when the listing is filtered.
+			if (!entry.key.isDirectory() || (filter && directoryAggregates[i].fileCount == 0)) {
+				continue;
+			}
+
+			appendAggregate(out, table.pathData(entry), entry.pathLength, directoryAggregates[i]);
+			flushIfFull();
+		}
+	}
+
+	if (m_listTotals) {
+		appendAggregate(out, nullptr, 0, totals);
+	}
+
+	stream.write(out.data(), static_cast<std::streamsize>(out.size()));
+	stream.flush();
+
+	if (!stream) {
+		std::cerr << "Unable to write records." << std::endl;
+		return false;
+	}
+
+	return missingCount == 0;
+}
+
+bool EntryLister::parseFormat(const std::string& name, Format& format)
+{
+	if (boost::algorithm::iequals(name, "ndjson") || boost::algorithm::iequals(name, "json")) {
+		format = Format::NDJSON;
+		return true;
+	}
+	if (boost::algorithm::iequals(name, "csv")) {
+		format = Format::CSV;
+		return true;
+	}
+
+	return false;
+}
+
+void EntryLister::appendHeader(std::string& out) const
+{
+	// All record types share the columns, fields which do not apply to a record are left empty.
+	if (m_format == Format::CSV) {
+		out += "type,path,files,size1,size2,flags,volumeIndex,sectorIndex\n";
+	}
+}
+
+void EntryLister::appendFile(std::string& out, const char* path, size_t pathLength, const NodeKey& nodeKey) const
+{
+	if (m_format == Format::CSV) {
+		out += "file,";
+		appendString(out, path, pathLength, m_format);
+		out += ",,";
+		appendNumber(out, nodeKey.size1());
+		out += ',';
+		appendNumber(out, nodeKey.size2());
+		out += ',';
+		appendNumber(out, nodeKey.flags());
+		out += ',';
+		appendNumber(out, nodeKey.volumeIndex());
+		out += ',';
+		appendNumber(out, nodeKey.sectorIndex());
+		out += '\n';
+	} else {
+		out += "{\"type\":\"file\",\"path\":";
+		appendString(out, path, pathLength, m_format);
+		out += ",\"size1\":";
+		appendNumber(out, nodeKey.size1());
+		out += ",\"size2\":";
+		appendNumber(out, nodeKey.size2());
+		out += ",\"flags\":";
+		appendNumber(out, nodeKey.flags());
+		out += ",\"volumeIndex\":";
+		appendNumber(out, nodeKey.volumeIndex());
+		out += ",\"sectorIndex\":";
+		appendNumber(out, nodeKey.sectorIndex());
+		out += "}\n";
+	}
+}
+
+void EntryLister::appendAggregate(std::string& out, const char* path, size_t pathLength, const Aggregate& aggregate) const
+{
+	if (m_format == Format::CSV) {
+		if (path) {
+			out += "dir,";
+			appendString(out, path, pathLength, m_format);
+		} else {
+			out += "total,";
+		}
+		out += ',';
+		appendNumber(out, aggregate.fileCount);
+		out += ',';
+		appendNumber(out, aggregate.size1);
+		out += ',';
+		appendNumber(out, aggregate.size2);
+		out += ",,,\n";
+	} else {
+		if (path) {
+			out += "{\"type\":\"dir\",\"path\":";
+			appendString(out, path, pathLength, m_format);
+			out += ',';
+		} else {
+			out += "{\"type\":\"total\",";
+		}
+		out += "\"files\":";
+		appendNumber(out, aggregate.fileCount);
+		out += ",\"size1\":";
+		appendNumber(out, aggregate.size1);
+		out += ",\"size2\":";
+		appendNumber(out, aggregate.size2);
+		out += "}\n";
+	}
+}
+
+void EntryLister::appendString(std::string& out, const char* str, size_t length, Format format)
+{
+	static const char s_hexDigits[] = "0123456789ABCDEF";
+
+	if (format == Format::CSV) {
+		// Fields are quoted only if they need to be.
+		const auto needsQuotes = std::any_of(str, str + length, [](char c) {
+			return c == ',' || c == '"' || c == '\n' || c == '\r';
+		});
+		if (!needsQuotes) {
+			out.append(str, length);
+			return;
+		}
+
+		out += '"';
+		for (auto i = size_t(0); i < length; ++i) {
+			if (str[i] == '"') {
+				out += '"';
+			}
+			out += str[i];
+		}
+		out += '"';
+		return;
+	}
+
+	out += '"';
+	for (auto i = size_t(0); i < length; ++i) {
+		const auto c = static_cast<unsigned char>(str[i]);
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += static_cast<char>(c);
+		} else if (c < 0x20 || c >= 0x80) {
+			// Names are not known to be UTF-8, so bytes outside of ASCII are escaped as code points of the same value.
+			out += "\\u00";
+			out += s_hexDigits[c >> 4];
+			out += s_hexDigits[c & 0xF];
+		} else {
+			out += static_cast<char>(c);
+		}
+	}
+	out += '"';
+}
+
+void EntryLister::appendNumber(std::string& out, uint64_t value)
+{
+	char digits[20];
+	auto count = 0u;
+	do {
+		digits[count++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	while (count != 0) {
+		out += digits[--count];
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "entry_filter.hpp"
+#include "volume.hpp"
+
+#include <ostream>
+#include <string>
+
+// Streams metadata of files of a loaded volume (path, stored and uncompressed sizes, flags and location) without reading any
+// node data. Entries come from the path table and are joined with nodes in one batch. Records are formatted into a large
+// buffer which is written out in big chunks.
+class EntryLister
+	: private boost::noncopyable
+{
+public:
+	enum class Format
+	{
+		NDJSON,
+		CSV,
+	};
+
+	static const auto OUTPUT_BUFFER_SIZE = size_t(0x100000);
+
+	explicit EntryLister(const VolumeFile& volume)
+		: m_volume(volume)
+		, m_format(Format::NDJSON)
+		, m_listFiles(true)
+		, m_listDirectories(false)
+		, m_listTotals(false)
+	{
+	}
+
+	void setFormat(Format format) { m_format = format; }
+	Format format() const { return m_format; }
+
+	// Records of files, aggregates of directories (including their subdirectories) and totals of the whole listing can be
+	// enabled independently. Aggregates start with the root directory, which has an empty path.
+	void setListFiles(bool listFiles) { m_listFiles = listFiles; }
+	void setListDirectories(bool listDirectories) { m_listDirectories = listDirectories; }
+	void setListTotals(bool listTotals) { m_listTotals = listTotals; }
+
+	// If a filter is given it has to be prepared against the path table of the volume. Files whose nodes are missing are
+	// reported and left out, then the listing is completed but fails.
+	bool list(std::ostream& stream, const EntryFilter* filter = nullptr) const;
+
+	static bool parseFormat(const std::string& name, Format& format);
+
+private:
+	struct Aggregate
+	{
+		uint64_t fileCount;
+		uint64_t size1;
+		uint64_t size2;
+	};
+
+	void appendHeader(std::string& out) const;
+	void appendFile(std::string& out, const char* path, size_t pathLength, const NodeKey& nodeKey) const;
+	// Without a path it is appended as the totals record.
+	void appendAggregate(std::string& out, const char* path, size_t pathLength, const Aggregate& aggregate) const;
+
+	static void appendString(std::string& out, const char* str, size_t length, Format format);
+	static void appendNumber(std::string& out, uint64_t value);
+
+	const VolumeFile& m_volume;
+
+	Format m_format;
+	bool m_listFiles;
+	bool m_listDirectories;
+	bool m_listTotals;
+};
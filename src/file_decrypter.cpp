@@ -0,0 +1,247 @@
+#include "file_decrypter.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#ifdef _WIN32
+#	include <fcntl.h>
+#	include <io.h>
+#endif
+
+const char* const FileDecrypter::STDIO_PATH = "-";
+
+// Files are decrypted concurrently, so their messages are printed one at a time.
+static std::mutex s_errorMutex;
+
+FileDecrypter::FileDecrypter(const Salsa20Cipher& cipher)
+	: m_cipher(cipher)
+	, m_threadPool(nullptr)
+	, m_chunkSize(DEFAULT_CHUNK_SIZE)
+	, m_initialCounter(0)
+	, m_useMemoryMapping(true)
+{
+}
+
+void FileDecrypter::setChunkSize(size_t chunkSize)
+{
+	const auto blockSize = size_t(Salsa20Cipher::BLOCK_SIZE);
+
+	m_chunkSize = std::max(alignUp(chunkSize, blockSize), blockSize);
+}
+
+static size_t readFromStream(std::istream& stream, uint8_t* data, size_t dataSize)
+{
+	auto totalSize = size_t(0);
+
+	while (totalSize < dataSize && stream) {
+		stream.read(reinterpret_cast<char*>(data + totalSize), dataSize - totalSize);
+		totalSize += static_cast<size_t>(stream.gcount());
+	}
+
+	return totalSize;
+}
+
+bool FileDecrypter::decrypt(const std::string& inFilePath, const std::string& outFilePath, uint64_t* processedSize) const
+{
+	// Every worker gets a couple of chunks, so it has the next one to decrypt while previous ones are being written.
+	const auto chunkCount = m_threadPool ? size_t(m_threadPool->threadCount()) * 2 : size_t(1);
+
+	return decrypt(inFilePath, outFilePath, processedSize, chunkCount);
+}
+
+bool FileDecrypter::decrypt(const std::string& inFilePath, const std::string& outFilePath, uint64_t* processedSize, size_t chunkCount) const
+{
+	const auto fromStdin = (inFilePath == STDIO_PATH);
+	const auto toStdout = (outFilePath == STDIO_PATH);
+
+#ifdef _WIN32
+	if (fromStdin) {
+		_setmode(_fileno(stdin), _O_BINARY);
+	}
+	if (toStdout) {
+		_setmode(_fileno(stdout), _O_BINARY);
+	}
+#endif
+
+	InputFile inFile;
+	if (!fromStdin) {
+		if (!inFile.open(inFilePath)) {
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << "Unable to open input file: " << inFilePath << std::endl;
+			return false;
+		}
+		if (m_useMemoryMapping && inFile.map()) {
+			inFile.adviseSequential(0, inFile.size());
+		}
+	}
+
+	// Opening output file in place of input one would truncate it before it is read, so a temporary file is written instead.
+	auto tmpFilePath = outFilePath;
+	if (!fromStdin && !toStdout) {
+		boost::system::error_code ec;
+		if (boost::filesystem::equivalent(inFilePath, outFilePath, ec)) {
+			tmpFilePath += ".tmp";
+		}
+	}
+
+	std::ofstream outFile;
+	if (!toStdout) {
+		outFile.open(tmpFilePath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+		if (!outFile) {
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << "Unable to create output file: " << tmpFilePath << std::endl;
+			return false;
+		}
+	}
+	std::ostream& outStream = toStdout ? std::cout : outFile;
+
+	std::vector<std::vector<uint8_t>> chunks(chunkCount);
+	std::vector<size_t> chunkSizes(chunkCount);
+
+	auto offset = uint64_t(0);
+	auto endOfInput = false;
+	auto success = true;
+
+	while (!endOfInput && success) {
+		auto count = size_t(0);
+		for (; count < chunkCount && !endOfInput; ++count) {
+			auto& chunk = chunks[count];
+			chunk.resize(m_chunkSize);
+
+			auto chunkSize = size_t(0);
+			if (fromStdin) {
+				chunkSize = readFromStream(std::cin, chunk.data(), m_chunkSize);
+				if (std::cin.bad()) {
+					std::lock_guard<std::mutex> lock(s_errorMutex);
+					std::cerr << "Unable to read input stream." << std::endl;
+					success = false;
+				}
+			} else {
+				const auto chunkOffset = offset + count * m_chunkSize;
+				chunkSize = static_cast<size_t>(std::min(static_cast<uint64_t>(m_chunkSize), inFile.size() - std::min(chunkOffset, inFile.size())));
+			}
+
+			chunkSizes[count] = chunkSize;
+			endOfInput = (chunkSize < m_chunkSize);
+		}
+		if (!success) {
+			break;
+		}
+
+		std::atomic<bool> readFailed(false);
+		{
+			TaskGroup taskGroup(m_threadPool);
+
+			for (auto i = 0u; i < count; ++i) {
+				const auto chunkOffset = offset + i * m_chunkSize;
+				const auto chunkSize = chunkSizes[i];
+				if (chunkSize == 0) {
+					continue;
+				}
+
+				auto chunkData = chunks[i].data();
+
+				taskGroup.run([this, &inFile, &readFailed, fromStdin, chunkOffset, chunkData, chunkSize]() {
+					Salsa20Cipher cipher(m_cipher);
+					cipher.setCounter(m_initialCounter + chunkOffset / Salsa20Cipher::BLOCK_SIZE);
+
+					if (fromStdin) {
+						cipher.processBytes(chunkData, chunkData, chunkSize);
+						return;
+					}
+
+					const auto view = inFile.viewAt(chunkOffset, chunkSize);
+					if (!view.empty()) {
+						cipher.processBytes(view.data(), chunkData, chunkSize);
+					} else if (inFile.readAt(chunkOffset, chunkData, chunkSize)) {
+						cipher.processBytes(chunkData, chunkData, chunkSize);
+					} else {
+						readFailed = true;
+					}
+				});
+			}
+
+			taskGroup.wait();
+		}
+		if (readFailed) {
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << "Unable to read input file: " << inFilePath << std::endl;
+			success = false;
+			break;
+		}
+
+		for (auto i = 0u; i < count; ++i) {
+			outStream.write(reinterpret_cast<const char*>(chunks[i].data()), chunkSizes[i]);
+			offset += chunkSizes[i];
+		}
+		if (!outStream) {
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << "Unable to write output file: " << outFilePath << std::endl;
+			success = false;
+		}
+	}
+
+	outStream.flush();
+
+	if (!toStdout) {
+		outFile.close();
+		inFile.close();
+
+		if (success && tmpFilePath != outFilePath) {
+			boost::system::error_code ec;
+			boost::filesystem::rename(tmpFilePath, outFilePath, ec);
+			if (ec) {
+				std::lock_guard<std::mutex> lock(s_errorMutex);
+				std::cerr << "Unable to replace output file: " << outFilePath << std::endl;
+				success = false;
+			}
+		}
+		if (!success) {
+			boost::system::error_code ec;
+			boost::filesystem::remove(tmpFilePath, ec);
+		}
+	}
+
+	if (processedSize) {
+		*processedSize = offset;
+	}
+
+	return success;
+}
+
+size_t FileDecrypter::decryptFiles(const JobList& jobs, uint64_t* processedSize) const
+{
+	std::atomic<size_t> failedCount(0);
+	std::atomic<uint64_t> totalSize(0);
+
+	{
+		// Files already keep the pool busy, so each of them holds only a few chunks and memory does not grow with the square
+		// of the thread count.
+		TaskGroup taskGroup(m_threadPool);
+
+		for (const auto& job: jobs) {
+			taskGroup.run([this, &job, &failedCount, &totalSize]() {
+				auto size = uint64_t(0);
+				if (!decrypt(job.inFilePath, job.outFilePath, &size, BATCH_CHUNK_COUNT)) {
+					++failedCount;
+				}
+				totalSize += size;
+			});
+		}
+
+		taskGroup.wait();
+	}
+
+	if (processedSize) {
+		*processedSize = totalSize;
+	}
+
+	return failedCount;
+}
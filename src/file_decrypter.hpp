@@ -0,0 +1,61 @@
+#pragma once
+
+#include "crypto.hpp"
+#include "thread_pool.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Decrypts Salsa20 encrypted files chunk by chunk, so memory usage is bounded by chunk size and number of chunks in flight
+// rather than by file size. Each chunk seeks the cipher to its own block counter, so chunks can be processed in parallel.
+class FileDecrypter
+	: private boost::noncopyable
+{
+public:
+	static const auto DEFAULT_CHUNK_SIZE = size_t(0x100000);
+
+	// Path which stands for stdin/stdout.
+	static const char* const STDIO_PATH;
+
+	struct Job
+	{
+		std::string inFilePath;
+		std::string outFilePath;
+	};
+	typedef std::vector<Job> JobList;
+
+	explicit FileDecrypter(const Salsa20Cipher& cipher);
+
+	void setThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
+	ThreadPool* threadPool() const { return m_threadPool; }
+
+	// Chunk size is rounded up to a multiple of cipher block size.
+	void setChunkSize(size_t chunkSize);
+	size_t chunkSize() const { return m_chunkSize; }
+
+	void setInitialCounter(uint64_t counter) { m_initialCounter = counter; }
+	uint64_t initialCounter() const { return m_initialCounter; }
+
+	void setUseMemoryMapping(bool useMemoryMapping) { m_useMemoryMapping = useMemoryMapping; }
+
+	bool decrypt(const std::string& inFilePath, const std::string& outFilePath, uint64_t* processedSize = nullptr) const;
+
+	// Decrypts files concurrently on the thread pool with the same key, returns number of files which failed.
+	size_t decryptFiles(const JobList& jobs, uint64_t* processedSize = nullptr) const;
+
+private:
+	static const auto BATCH_CHUNK_COUNT = size_t(2);
+
+	bool decrypt(const std::string& inFilePath, const std::string& outFilePath, uint64_t* processedSize, size_t chunkCount) const;
+
+	const Salsa20Cipher m_cipher;
+
+	ThreadPool* m_threadPool;
+
+	size_t m_chunkSize;
+	uint64_t m_initialCounter;
+
+	bool m_useMemoryMapping;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Arrays of flat images (e.g. tables kept in the TOC cache) are aligned, so an image which is mapped or read into an aligned
+// buffer is viewed in place. Images are host-specific (layout and byte order).
+static const auto IMAGE_ARRAY_ALIGNMENT = size_t(8);
+
+template<typename T>
+inline void appendImageArray(ByteBuffer& image, const T* data, size_t count)
+{
+	const auto offset = image.size();
+	const auto size = count * sizeof(T);
+
+	image.resize(alignUp(offset + size, IMAGE_ARRAY_ALIGNMENT), 0);
+	if (size != 0) {
+		std::memcpy(image.data() + offset, data, size);
+	}
+}
+
+// Views the next array of the image and moves past it, fails if the image is too short or misaligned.
+template<typename T>
+inline bool viewImageArray(ConstByteSpan& image, uint64_t count, Span<const T>& view)
+{
+	if (count > image.size() / sizeof(T) || (reinterpret_cast<uintptr_t>(image.data()) % alignof(T)) != 0) {
+		return false;
+	}
+
+	const auto size = static_cast<size_t>(count) * sizeof(T);
+	const auto skipSize = std::min(alignUp(size, IMAGE_ARRAY_ALIGNMENT), image.size());
+
+	view = Span<const T>(reinterpret_cast<const T*>(image.data()), static_cast<size_t>(count));
+	image = image.subspan(skipSize, image.size() - skipSize);
+
+	return true;
+}
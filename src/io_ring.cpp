@@ -0,0 +1,323 @@
+#include "io_ring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef USE_IO_URING
+#	include <fcntl.h>
+#	include <linux/io_uring.h>
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+IoRing::IoRing()
+	: m_fd(-1)
+	, m_sqRing(nullptr)
+	, m_sqRingSize(0)
+	, m_cqRing(nullptr)
+	, m_cqRingSize(0)
+	, m_sqes(nullptr)
+	, m_sqesSize(0)
+	, m_sqHead(nullptr)
+	, m_sqTail(nullptr)
+	, m_sqMask(nullptr)
+	, m_sqArray(nullptr)
+	, m_sqEntryCount(0)
+	, m_cqHead(nullptr)
+	, m_cqTail(nullptr)
+	, m_cqMask(nullptr)
+	, m_cqes(nullptr)
+{
+}
+
+IoRing::~IoRing()
+{
+	destroy();
+}
+
+bool IoRing::read(Request* requests, size_t count)
+{
+#ifdef USE_IO_URING
+	return execute(IORING_OP_READ, requests, count, 0, 0);
+#else
+	return false;
+#endif
+}
+
+bool IoRing::write(Request* requests, size_t count)
+{
+#ifdef USE_IO_URING
+	return execute(IORING_OP_WRITE, requests, count, 0, 0);
+#else
+	return false;
+#endif
+}
+
+bool IoRing::open(Request* requests, size_t count, int flags, unsigned int mode)
+{
+#ifdef USE_IO_URING
+	return execute(IORING_OP_OPENAT, requests, count, flags, mode);
+#else
+	return false;
+#endif
+}
+
+bool IoRing::close(Request* requests, size_t count)
+{
+#ifdef USE_IO_URING
+	return execute(IORING_OP_CLOSE, requests, count, 0, 0);
+#else
+	return false;
+#endif
+}
+
+#ifdef USE_IO_URING
+
+template<typename T>
+static inline T* ringPointer(void* ring, uint32_t offset)
+{
+	return reinterpret_cast<T*>(static_cast<uint8_t*>(ring) + offset);
+}
+
+bool IoRing::init(unsigned int entryCount)
+{
+	destroy();
+
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+
+	const auto fd = static_cast<int>(::syscall(__NR_io_uring_setup, entryCount, &params));
+	if (fd < 0) {
+		return false;
+	}
+	m_fd = fd;
+
+	// Kernels without the operations used here (before 5.6) are treated as ones without io_uring at all.
+	const auto probeOpCount = 256u;
+	std::vector<uint8_t> probeData(sizeof(io_uring_probe) + probeOpCount * sizeof(io_uring_probe_op));
+	auto* probe = reinterpret_cast<io_uring_probe*>(probeData.data());
+	if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, probeOpCount) < 0) {
+		destroy();
+		return false;
+	}
+	for (const auto opcode: { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_OPENAT, IORING_OP_CLOSE }) {
+		if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+			destroy();
+			return false;
+		}
+	}
+
+	m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	const auto singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMapping) {
+		m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+	}
+
+	m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if (m_sqRing == MAP_FAILED) {
+		m_sqRing = nullptr;
+		destroy();
+		return false;
+	}
+	if (singleMapping) {
+		m_cqRing = m_sqRing;
+	} else {
+		m_cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED) {
+			m_cqRing = nullptr;
+			destroy();
+			return false;
+		}
+	}
+
+	m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	m_sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+	if (m_sqes == MAP_FAILED) {
+		m_sqes = nullptr;
+		destroy();
+		return false;
+	}
+
+	m_sqHead = ringPointer<unsigned int>(m_sqRing, params.sq_off.head);
+	m_sqTail = ringPointer<unsigned int>(m_sqRing, params.sq_off.tail);
+	m_sqMask = ringPointer<unsigned int>(m_sqRing, params.sq_off.ring_mask);
+	m_sqArray = ringPointer<unsigned int>(m_sqRing, params.sq_off.array);
+	m_sqEntryCount = params.sq_entries;
+
+	m_cqHead = ringPointer<unsigned int>(m_cqRing, params.cq_off.head);
+	m_cqTail = ringPointer<unsigned int>(m_cqRing, params.cq_off.tail);
+	m_cqMask = ringPointer<unsigned int>(m_cqRing, params.cq_off.ring_mask);
+	m_cqes = ringPointer<void>(m_cqRing, params.cq_off.cqes);
+
+	return true;
+}
+
+void IoRing::destroy()
+{
+	if (m_sqes) {
+		::munmap(m_sqes, m_sqesSize);
+		m_sqes = nullptr;
+	}
+	if (m_cqRing && m_cqRing != m_sqRing) {
+		::munmap(m_cqRing, m_cqRingSize);
+	}
+	m_cqRing = nullptr;
+	if (m_sqRing) {
+		::munmap(m_sqRing, m_sqRingSize);
+		m_sqRing = nullptr;
+	}
+
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+
+	m_sqHead = m_sqTail = m_sqMask = m_sqArray = nullptr;
+	m_cqHead = m_cqTail = m_cqMask = nullptr;
+	m_cqes = nullptr;
+	m_sqEntryCount = 0;
+}
+
+int IoRing::enter(unsigned int submitCount, unsigned int waitCount)
+{
+	const auto flags = (waitCount != 0) ? IORING_ENTER_GETEVENTS : 0u;
+
+	for (;;) {
+		const auto result = ::syscall(__NR_io_uring_enter, m_fd, submitCount, waitCount, flags, nullptr, 0);
+		if (result >= 0 || errno != EINTR) {
+			return static_cast<int>(result);
+		}
+	}
+}
+
+bool IoRing::execute(uint8_t opcode, Request* requests, size_t count, int flags, unsigned int mode)
+{
+	if (!isAvailable()) {
+		return false;
+	}
+
+	const auto isTransfer = (opcode == IORING_OP_READ || opcode == IORING_OP_WRITE);
+	const auto maxTransferSize = UINT64_C(0x40000000);
+
+	m_progress.assign(count, 0);
+	for (auto i = size_t(0); i < count; ++i) {
+		requests[i].result = -ECANCELED;
+	}
+
+	std::vector<size_t> retries;
+	auto nextIndex = size_t(0);
+	auto inFlightCount = 0u;
+	auto unsubmittedCount = 0u;
+
+	auto* sqes = static_cast<io_uring_sqe*>(m_sqes);
+	const auto* cqes = static_cast<const io_uring_cqe*>(m_cqes);
+
+	while (nextIndex < count || !retries.empty() || inFlightCount != 0 || unsubmittedCount != 0) {
+		// Completion ring is twice as big as submission ring, so keeping no more than the latter in flight can't overflow it.
+		auto tail = *m_sqTail;
+		while (inFlightCount + unsubmittedCount < m_sqEntryCount && (nextIndex < count || !retries.empty())) {
+			size_t index;
+			if (!retries.empty()) {
+				index = retries.back();
+				retries.pop_back();
+			} else {
+				index = nextIndex++;
+			}
+			auto& request = requests[index];
+
+			const auto slot = tail & *m_sqMask;
+			auto& sqe = sqes[slot];
+			std::memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = opcode;
+			sqe.user_data = index;
+
+			if (isTransfer) {
+				const auto done = m_progress[index];
+				sqe.fd = request.fd;
+				sqe.off = request.offset + done;
+				sqe.addr = reinterpret_cast<uint64_t>(static_cast<uint8_t*>(request.data) + done);
+				sqe.len = static_cast<uint32_t>(std::min<uint64_t>(request.size - done, maxTransferSize));
+			} else if (opcode == IORING_OP_OPENAT) {
+				sqe.fd = AT_FDCWD;
+				sqe.addr = reinterpret_cast<uint64_t>(request.path);
+				sqe.len = mode;
+				sqe.open_flags = static_cast<uint32_t>(flags);
+			} else {
+				sqe.fd = request.fd;
+			}
+
+			m_sqArray[slot] = slot;
+			++tail;
+			++unsubmittedCount;
+		}
+		__atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+		// Submission stops after an entry which can't be even prepared (its error is posted as a completion), the rest stays
+		// in the ring for the next call and the kernel does not wait in that case.
+		const auto submittedCount = enter(unsubmittedCount, 1);
+		if (submittedCount < 0) {
+			// State of the rings is unknown now, so it is torn down and callers fall back to regular I/O from now on.
+			destroy();
+			return false;
+		}
+		unsubmittedCount -= static_cast<unsigned int>(submittedCount);
+		inFlightCount += static_cast<unsigned int>(submittedCount);
+
+		auto head = *m_cqHead;
+		const auto cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+		for (; head != cqTail; ++head) {
+			const auto& cqe = cqes[head & *m_cqMask];
+			const auto index = static_cast<size_t>(cqe.user_data);
+			auto& request = requests[index];
+			--inFlightCount;
+
+			if (!isTransfer) {
+				request.result = cqe.res;
+				continue;
+			}
+
+			if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+				retries.push_back(index);
+			} else if (cqe.res < 0) {
+				request.result = cqe.res;
+			} else {
+				auto& done = m_progress[index];
+				done += static_cast<uint64_t>(cqe.res);
+				if (cqe.res != 0 && done < request.size) {
+					retries.push_back(index);
+				} else {
+					request.result = static_cast<int64_t>(done);
+				}
+			}
+		}
+		__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	return true;
+}
+
+#else
+
+bool IoRing::init(unsigned int entryCount)
+{
+	return false;
+}
+
+void IoRing::destroy()
+{
+}
+
+int IoRing::enter(unsigned int submitCount, unsigned int waitCount)
+{
+	return -1;
+}
+
+bool IoRing::execute(uint8_t opcode, Request* requests, size_t count, int flags, unsigned int mode)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Submission/completion ring of Linux io_uring, a whole array of reads, writes, opens or closes is issued with a few system
+// calls instead of one per operation. It is not thread-safe so every thread needs its own ring. If support is not compiled in
+// (USE_IO_URING) or the kernel lacks it then init() fails and callers are expected to fall back to regular I/O.
+class IoRing
+	: private boost::noncopyable
+{
+public:
+	static const auto DEFAULT_ENTRY_COUNT = 64u;
+
+	struct Request
+	{
+		Request()
+			: fd(-1)
+			, path(nullptr)
+			, offset(0)
+			, data(nullptr)
+			, size(0)
+			, result(0)
+		{
+		}
+
+		int fd;
+		const char* path;
+
+		uint64_t offset;
+		void* data;
+		size_t size;
+
+		// Number of bytes transferred for reads/writes (less than size on failure), descriptor for opens, zero for closes,
+		// or negated errno value (-ECANCELED if request was not completed because ring failed).
+		int64_t result;
+	};
+
+	IoRing();
+	~IoRing();
+
+	bool init(unsigned int entryCount = DEFAULT_ENTRY_COUNT);
+	void destroy();
+
+	bool isAvailable() const { return m_fd >= 0; }
+
+	// Short transfers are resubmitted until request is complete or fails, return false only if ring itself fails.
+	bool read(Request* requests, size_t count);
+	bool write(Request* requests, size_t count);
+
+	// Mode is masked by umask as for files created by streams.
+	bool open(Request* requests, size_t count, int flags, unsigned int mode = 0666);
+	bool close(Request* requests, size_t count);
+
+private:
+	bool execute(uint8_t opcode, Request* requests, size_t count, int flags, unsigned int mode);
+
+	// Returns number of submitted entries or -1 on failure.
+	int enter(unsigned int submitCount, unsigned int waitCount);
+
+	int m_fd;
+
+	void* m_sqRing;
+	size_t m_sqRingSize;
+	void* m_cqRing;
+	size_t m_cqRingSize;
+	void* m_sqes;
+	size_t m_sqesSize;
+
+	unsigned int* m_sqHead;
+	unsigned int* m_sqTail;
+	unsigned int* m_sqMask;
+	unsigned int* m_sqArray;
+	unsigned int m_sqEntryCount;
+
+	unsigned int* m_cqHead;
+	unsigned int* m_cqTail;
+	unsigned int* m_cqMask;
+	void* m_cqes;
+
+	std::vector<uint64_t> m_progress;
+};
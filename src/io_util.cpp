@@ -1,7 +1,19 @@
 #include "io_util.hpp"
 
+#include <algorithm>
+#include <cerrno>
 #include <fstream>
 #include <iostream>
+#include <utility>
+
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
 
 bool loadFromFile(const std::string& filePath, std::vector<uint8_t>& data)
 {
@@ -36,3 +48,320 @@ bool saveToFile(const std::string& filePath, const void* data, size_t dataSize)
 		return false;
 	}
 }
+
+#ifdef _WIN32
+
+InputFile::InputFile()
+	: m_handle(INVALID_HANDLE_VALUE)
+	, m_mappingHandle(nullptr)
+	, m_size(0)
+	, m_mappedData(nullptr)
+{
+}
+
+InputFile::InputFile(InputFile&& other)
+	: m_handle(other.m_handle)
+	, m_mappingHandle(other.m_mappingHandle)
+	, m_size(other.m_size)
+	, m_mappedData(other.m_mappedData)
+{
+	other.m_handle = INVALID_HANDLE_VALUE;
+	other.m_mappingHandle = nullptr;
+	other.m_size = 0;
+	other.m_mappedData = nullptr;
+}
+
+InputFile& InputFile::operator =(InputFile&& other)
+{
+	if (this != &other) {
+		close();
+		std::swap(m_handle, other.m_handle);
+		std::swap(m_mappingHandle, other.m_mappingHandle);
+		std::swap(m_size, other.m_size);
+		std::swap(m_mappedData, other.m_mappedData);
+	}
+	return *this;
+}
+
+bool InputFile::open(const std::string& filePath)
+{
+	close();
+
+	const auto handle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize)) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	m_handle = handle;
+	m_size = static_cast<uint64_t>(fileSize.QuadPart);
+
+	return true;
+}
+
+void InputFile::close()
+{
+	unmap();
+
+	if (m_handle != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_handle);
+		m_handle = INVALID_HANDLE_VALUE;
+	}
+	m_size = 0;
+}
+
+bool InputFile::map()
+{
+	if (!isOpen() || m_size == 0 || m_size > SIZE_MAX) {
+		return false;
+	}
+	if (isMapped()) {
+		return true;
+	}
+
+	const auto mappingHandle = CreateFileMappingA(m_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle) {
+		return false;
+	}
+
+	const auto mappedData = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!mappedData) {
+		CloseHandle(mappingHandle);
+		return false;
+	}
+
+	m_mappingHandle = mappingHandle;
+	m_mappedData = static_cast<const uint8_t*>(mappedData);
+
+	return true;
+}
+
+void InputFile::unmap()
+{
+	if (m_mappedData) {
+		UnmapViewOfFile(m_mappedData);
+		m_mappedData = nullptr;
+	}
+	if (m_mappingHandle) {
+		CloseHandle(m_mappingHandle);
+		m_mappingHandle = nullptr;
+	}
+}
+
+bool InputFile::isOpen() const
+{
+	return m_handle != INVALID_HANDLE_VALUE;
+}
+
+bool InputFile::readAt(uint64_t offset, void* data, size_t dataSize) const
+{
+	auto* p = static_cast<uint8_t*>(data);
+
+	if (isMapped()) {
+		const auto view = viewAt(offset, dataSize);
+		if (view.size() != dataSize) {
+			return false;
+		}
+		std::memcpy(p, view.data(), dataSize);
+		return true;
+	}
+
+	while (dataSize > 0) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		const auto count = static_cast<DWORD>(std::min<size_t>(dataSize, UINT32_C(0x40000000)));
+		DWORD readCount = 0;
+		if (!ReadFile(m_handle, p, count, &readCount, &overlapped) || readCount == 0) {
+			return false;
+		}
+
+		p += readCount;
+		offset += readCount;
+		dataSize -= readCount;
+	}
+
+	return true;
+}
+
+// There is no madvise() equivalent for file mappings that would be available on every supported Windows version.
+void InputFile::adviseSequential(uint64_t offset, uint64_t dataSize) const
+{
+}
+
+void InputFile::adviseWillNeed(uint64_t offset, uint64_t dataSize) const
+{
+}
+
+#else
+
+InputFile::InputFile()
+	: m_fd(-1)
+	, m_size(0)
+	, m_mappedData(nullptr)
+{
+}
+
+InputFile::InputFile(InputFile&& other)
+	: m_fd(other.m_fd)
+	, m_size(other.m_size)
+	, m_mappedData(other.m_mappedData)
+{
+	other.m_fd = -1;
+	other.m_size = 0;
+	other.m_mappedData = nullptr;
+}
+
+InputFile& InputFile::operator =(InputFile&& other)
+{
+	if (this != &other) {
+		close();
+		std::swap(m_fd, other.m_fd);
+		std::swap(m_size, other.m_size);
+		std::swap(m_mappedData, other.m_mappedData);
+	}
+	return *this;
+}
+
+bool InputFile::open(const std::string& filePath)
+{
+	close();
+
+	const auto fd = ::open(filePath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	m_fd = fd;
+	m_size = static_cast<uint64_t>(st.st_size);
+
+	return true;
+}
+
+void InputFile::close()
+{
+	unmap();
+
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+	m_size = 0;
+}
+
+bool InputFile::map()
+{
+	if (!isOpen() || m_size == 0 || m_size > SIZE_MAX) {
+		return false;
+	}
+	if (isMapped()) {
+		return true;
+	}
+
+	const auto mappedData = ::mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_SHARED, m_fd, 0);
+	if (mappedData == MAP_FAILED) {
+		return false;
+	}
+
+	m_mappedData = static_cast<const uint8_t*>(mappedData);
+
+	return true;
+}
+
+void InputFile::unmap()
+{
+	if (m_mappedData) {
+		::munmap(const_cast<uint8_t*>(m_mappedData), static_cast<size_t>(m_size));
+		m_mappedData = nullptr;
+	}
+}
+
+bool InputFile::isOpen() const
+{
+	return m_fd >= 0;
+}
+
+bool InputFile::readAt(uint64_t offset, void* data, size_t dataSize) const
+{
+	auto* p = static_cast<uint8_t*>(data);
+
+	if (isMapped()) {
+		const auto view = viewAt(offset, dataSize);
+		if (view.size() != dataSize) {
+			return false;
+		}
+		std::memcpy(p, view.data(), dataSize);
+		return true;
+	}
+
+	while (dataSize > 0) {
+		const auto count = ::pread(m_fd, p, dataSize, static_cast<off_t>(offset));
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if (count == 0) {
+			return false;
+		}
+
+		p += count;
+		offset += static_cast<uint64_t>(count);
+		dataSize -= static_cast<size_t>(count);
+	}
+
+	return true;
+}
+
+static void adviseMappedRange(const uint8_t* mappedData, uint64_t mappedSize, uint64_t offset, uint64_t dataSize, int advice)
+{
+	if (!mappedData || offset >= mappedSize || dataSize == 0) {
+		return;
+	}
+
+	static const auto pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+
+	const auto start = alignDown(offset, pageSize);
+	const auto end = std::min(offset + dataSize, mappedSize);
+
+	::madvise(const_cast<uint8_t*>(mappedData + start), static_cast<size_t>(end - start), advice);
+}
+
+void InputFile::adviseSequential(uint64_t offset, uint64_t dataSize) const
+{
+	adviseMappedRange(m_mappedData, m_size, offset, dataSize, MADV_SEQUENTIAL);
+}
+
+void InputFile::adviseWillNeed(uint64_t offset, uint64_t dataSize) const
+{
+	adviseMappedRange(m_mappedData, m_size, offset, dataSize, MADV_WILLNEED);
+}
+
+#endif
+
+InputFile::~InputFile()
+{
+	close();
+}
+
+ConstByteSpan InputFile::viewAt(uint64_t offset, size_t dataSize) const
+{
+	if (!isMapped() || offset > m_size || dataSize > m_size - offset) {
+		return ConstByteSpan();
+	}
+
+	return ConstByteSpan(m_mappedData + offset, dataSize);
+}
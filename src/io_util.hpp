@@ -3,9 +3,11 @@
 #include "util.hpp"
 
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include <boost/endian/conversion.hpp>
+#include <boost/noncopyable.hpp>
 
 template<typename T, typename CharT>
 inline T read(const CharT* buffer)
@@ -76,3 +78,52 @@ inline T readAtWithByteSwap(const CharT* buffer, size_t offset)
 
 bool loadFromFile(const std::string& filePath, std::vector<uint8_t>& data);
 bool saveToFile(const std::string& filePath, const void* data, size_t dataSize);
+
+// Read-only file with positioned reads, it does not have a shared seek cursor so it can be read from multiple threads at once.
+// It can be also mapped into memory, in that case reads are served from the mapping and ranges can be viewed without copying.
+class InputFile
+	: private boost::noncopyable
+{
+public:
+	InputFile();
+	InputFile(InputFile&& other);
+	~InputFile();
+
+	InputFile& operator =(InputFile&& other);
+
+	bool open(const std::string& filePath);
+	void close();
+
+	bool map();
+	void unmap();
+
+	bool isOpen() const;
+	bool isMapped() const { return m_mappedData != nullptr; }
+
+	uint64_t size() const { return m_size; }
+
+	bool readAt(uint64_t offset, void* data, size_t dataSize) const;
+
+	// Returns an empty span if the file is not mapped or the range is out of bounds.
+	ConstByteSpan viewAt(uint64_t offset, size_t dataSize) const;
+
+	// Access pattern hints for mapped ranges, they are no-op if the file is not mapped.
+	void adviseSequential(uint64_t offset, uint64_t dataSize) const;
+	void adviseWillNeed(uint64_t offset, uint64_t dataSize) const;
+
+#ifndef _WIN32
+	// Descriptor for reads issued outside of this class (e.g. batched through IoRing).
+	int descriptor() const { return m_fd; }
+#endif
+
+private:
+#ifdef _WIN32
+	void* m_handle;
+	void* m_mappingHandle;
+#else
+	int m_fd;
+#endif
+	uint64_t m_size;
+
+	const uint8_t* m_mappedData;
+};
@@ -1,9 +1,126 @@
+#include "entry_lister.hpp"
+#include "file_decrypter.hpp"
 #include "volume.hpp"
 
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <unordered_set>
 
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
 #include <boost/program_options.hpp>
 
+// Output tree mirrors input directory tree.
+static void collectDirectoryDecryptJobs(const std::string& inDir, const std::string& outDir, FileDecrypter::JobList& jobs)
+{
+	for (boost::filesystem::recursive_directory_iterator it(inDir), end; it != end; ++it) {
+		if (!boost::filesystem::is_regular_file(it->status())) {
+			continue;
+		}
+
+		const auto relativePath = boost::filesystem::relative(it->path(), inDir);
+		const auto outFilePath = boost::filesystem::path(outDir) / relativePath;
+		boost::filesystem::create_directories(outFilePath.parent_path());
+
+		jobs.push_back({ it->path().string(), outFilePath.string() });
+	}
+}
+
+// Relative paths from the list are kept under output directory, absolute ones keep their structure below the deepest directory
+// which contains all of them. Paths which would leave output directory and files listed twice are rejected, since concurrent
+// decryption of two inputs into the same output would corrupt it.
+static bool collectListDecryptJobs(const std::string& listFile, const std::string& outDir, FileDecrypter::JobList& jobs)
+{
+	std::ifstream file(listFile);
+	if (!file) {
+		return false;
+	}
+
+	std::vector<boost::filesystem::path> inFilePaths;
+	boost::filesystem::path commonRoot;
+	auto hasAbsolutePaths = false;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		boost::algorithm::trim(line);
+		if (line.empty()) {
+			continue;
+		}
+
+		const auto inFilePath = boost::filesystem::path(line).lexically_normal();
+		inFilePaths.push_back(inFilePath);
+		if (!inFilePath.is_absolute()) {
+			continue;
+		}
+
+		if (!hasAbsolutePaths) {
+			commonRoot = inFilePath.parent_path();
+			hasAbsolutePaths = true;
+			continue;
+		}
+
+		boost::filesystem::path root;
+		const auto parentPath = inFilePath.parent_path();
+		for (auto it = commonRoot.begin(), jt = parentPath.begin(); it != commonRoot.end() && jt != parentPath.end() && *it == *jt; ++it, ++jt) {
+			root /= *it;
+		}
+		commonRoot = root;
+	}
+
+	std::unordered_set<std::string> outFilePaths;
+	for (const auto& inFilePath: inFilePaths) {
+		const auto relativePath = inFilePath.is_absolute() ? inFilePath.lexically_relative(commonRoot) : inFilePath;
+		if (relativePath.empty() || relativePath.is_absolute() || relativePath.has_root_path() || *relativePath.begin() == ".." || relativePath.filename_is_dot()) {
+			std::cerr << "Input path leads outside of output directory: " << inFilePath.string() << std::endl;
+			return false;
+		}
+
+		const auto outFilePath = (boost::filesystem::path(outDir) / relativePath).string();
+		if (!outFilePaths.insert(outFilePath).second) {
+			std::cerr << "Output file is listed more than once: " << outFilePath << std::endl;
+			return false;
+		}
+
+		jobs.push_back({ inFilePath.string(), outFilePath });
+	}
+
+	for (const auto& job: jobs) {
+		boost::filesystem::create_directories(boost::filesystem::path(job.outFilePath).parent_path());
+	}
+
+	return true;
+}
+
+static bool setupEntryFilter(const boost::program_options::variables_map& varMap, EntryFilter& filter)
+{
+	if (varMap.count("include")) {
+		for (const auto& pattern: varMap["include"].as<std::vector<std::string>>()) {
+			filter.addInclude(pattern);
+		}
+	}
+	if (varMap.count("exclude")) {
+		for (const auto& pattern: varMap["exclude"].as<std::vector<std::string>>()) {
+			filter.addExclude(pattern);
+		}
+	}
+	if (varMap.count("ext")) {
+		for (const auto& extension: varMap["ext"].as<std::vector<std::string>>()) {
+			filter.addExtension(extension);
+		}
+	}
+	if (varMap.count("root")) {
+		filter.setRoot(varMap["root"].as<std::string>());
+	}
+	if (varMap.count("from-list") && !filter.loadList(varMap["from-list"].as<std::string>())) {
+		std::cerr << "Unable to load list file." << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
 int main(int argc, const char* argv[])
 {
 	try {
@@ -11,6 +128,7 @@ int main(int argc, const char* argv[])
 		generalOpts.add_options()
 			("help,h", "Display help message")
 			("unpack,u", "Unpack volume files")
+			("list,l", "List files of volume without unpacking them")
 			("decrypt,d", "Decrypt file")
 		;
 
@@ -18,17 +136,54 @@ int main(int argc, const char* argv[])
 		unpackOpts.add_options()
 			("input,i", boost::program_options::value<std::string>(), "Volume/Index file")
 			("output,o", boost::program_options::value<std::string>(), "Output directory")
+			("jobs,j", boost::program_options::value<unsigned int>()->default_value(1), "Number of worker threads (0 = all cores)")
+			("no-mmap", "Read volume files without mapping them into memory")
+			("no-io-uring", "Do not batch reads and writes through io_uring")
+			("toc-cache", boost::program_options::value<std::string>()->implicit_value(""), "Keep decrypted TOC and its tables in a cache file (default = volume path + .toc)")
+			("chunk-size", boost::program_options::value<unsigned int>()->default_value(VolumeFile::DEFAULT_STREAM_CHUNK_SIZE >> 10), "Size in KiB of chunks used to stream large files")
+			("read-threads", boost::program_options::value<unsigned int>()->default_value(1), "Number of reader threads (0 = same as jobs)")
+			("decrypt-threads", boost::program_options::value<unsigned int>()->default_value(0), "Number of decrypter threads (0 = a quarter of jobs)")
+			("inflate-threads", boost::program_options::value<unsigned int>()->default_value(0), "Number of inflater threads (0 = rest of jobs)")
+			("write-threads", boost::program_options::value<unsigned int>()->default_value(1), "Number of writer threads (0 = same as jobs)")
+			("max-in-flight", boost::program_options::value<unsigned int>()->default_value(static_cast<unsigned int>(VolumeFile::DEFAULT_MAX_IN_FLIGHT_SIZE >> 20)), "Size in MiB of data held between extraction stages")
+			("read-gap", boost::program_options::value<unsigned int>()->default_value(static_cast<unsigned int>(VolumeFile::DEFAULT_MAX_READ_GAP >> 10)), "Size in KiB of largest gap between nodes read together")
+			("max-read-size", boost::program_options::value<unsigned int>()->default_value(static_cast<unsigned int>(VolumeFile::DEFAULT_MAX_READ_SIZE >> 10)), "Size in KiB of largest merged read (0 = do not merge)")
+		;
+
+		boost::program_options::options_description listOpts("List options");
+		listOpts.add_options()
+			("input,i", boost::program_options::value<std::string>(), "Volume/Index file")
+			("output,o", boost::program_options::value<std::string>()->default_value("-"), "Output file (- = stdout)")
+			("format,f", boost::program_options::value<std::string>()->default_value("ndjson"), "Record format (ndjson, csv)")
+			("totals", "Print totals record instead of file records")
+			("by-directory", "Print aggregate record of each directory (root included) instead of file records")
+			("jobs,j", boost::program_options::value<unsigned int>()->default_value(1), "Number of worker threads (0 = all cores)")
+			("no-mmap", "Read volume files without mapping them into memory")
+			("toc-cache", boost::program_options::value<std::string>()->implicit_value(""), "Keep decrypted TOC and its tables in a cache file (default = volume path + .toc)")
+		;
+
+		boost::program_options::options_description filterOpts("Unpack and list filter options");
+		filterOpts.add_options()
+			("include", boost::program_options::value<std::vector<std::string>>(), "Select only files matching the glob (* within directory, ** across directories)")
+			("exclude", boost::program_options::value<std::vector<std::string>>(), "Skip files matching the glob")
+			("ext", boost::program_options::value<std::vector<std::string>>(), "Select only files with the extension")
+			("root", boost::program_options::value<std::string>(), "Select only files under the directory")
+			("from-list", boost::program_options::value<std::string>(), "Select only files listed in the file, one path per line")
 		;
 
 		boost::program_options::options_description decryptOpts("Decrypt options");
 		decryptOpts.add_options()
-			("input,i", boost::program_options::value<std::string>(), "Input file")
-			("output,o", boost::program_options::value<std::string>(), "Output file")
+			("input,i", boost::program_options::value<std::string>(), "Input file (- = stdin) or directory")
+			("input-list", boost::program_options::value<std::string>(), "File with list of input files, one per line")
+			("output,o", boost::program_options::value<std::string>(), "Output file (- = stdout) or directory")
 			("key,k", boost::program_options::value<std::string>(), "Encryption key")
+			("counter,c", boost::program_options::value<uint64_t>()->default_value(0), "Initial cipher block counter")
+			("jobs,j", boost::program_options::value<unsigned int>()->default_value(1), "Number of worker threads (0 = all cores)")
+			("no-mmap", "Read input file without mapping it into memory")
 		;
 
 		boost::program_options::options_description allOpts;
-		allOpts.add(generalOpts).add(unpackOpts).add(decryptOpts);
+		allOpts.add(generalOpts).add(unpackOpts).add(listOpts).add(filterOpts).add(decryptOpts);
 
 		auto parsedOpts = boost::program_options::command_line_parser(argc, argv)
 			.style(boost::program_options::command_line_style::unix_style)
@@ -57,13 +212,17 @@ show_help:
 			);
 			boost::program_options::notify(restVarMap);
 
-			if (!restVarMap.count("input") || !restVarMap.count("output") || !restVarMap.count("key")) {
+			if ((!restVarMap.count("input") && !restVarMap.count("input-list")) || !restVarMap.count("output") || !restVarMap.count("key")) {
 				goto show_help;
 			}
 
-			const auto& inFile = restVarMap["input"].as<std::string>();
+			const auto inFile = restVarMap.count("input") ? restVarMap["input"].as<std::string>() : std::string();
+			const auto listFile = restVarMap.count("input-list") ? restVarMap["input-list"].as<std::string>() : std::string();
 			const auto& outFile = restVarMap["output"].as<std::string>();
 			const auto& keyStr = restVarMap["key"].as<std::string>();
+			const auto counter = restVarMap["counter"].as<uint64_t>();
+			const auto jobCount = restVarMap["jobs"].as<unsigned int>();
+			const auto useMemoryMapping = !restVarMap.count("no-mmap");
 
 			uint8_t key[0x20] = {};
 			if (parseHexString(keyStr, key, sizeof(key)) != sizeof(key)) {
@@ -71,32 +230,73 @@ show_help:
 				return EXIT_FAILURE;
 			}
 
-			if (!boost::filesystem::exists(inFile) || !boost::filesystem::is_regular_file(inFile)) {
+			std::unique_ptr<ThreadPool> threadPool;
+			if (jobCount != 1) {
+				threadPool.reset(new ThreadPool(jobCount));
+			}
+
+			// Cipher key is expanded once and then shared by all files and chunks.
+			FileDecrypter decrypter(Salsa20Cipher(key, sizeof(key)));
+			decrypter.setThreadPool(threadPool.get());
+			decrypter.setInitialCounter(counter);
+			decrypter.setUseMemoryMapping(useMemoryMapping);
+
+			if (!listFile.empty() || boost::filesystem::is_directory(inFile)) {
+				if (boost::filesystem::exists(outFile) && !boost::filesystem::is_directory(outFile)) {
+					std::cerr << "Invalid output directory specified." << std::endl;
+					return EXIT_FAILURE;
+				}
+
+				FileDecrypter::JobList jobs;
+				if (!listFile.empty()) {
+					if (!collectListDecryptJobs(listFile, outFile, jobs)) {
+						std::cerr << "Unable to load input list file." << std::endl;
+						return EXIT_FAILURE;
+					}
+				} else {
+					collectDirectoryDecryptJobs(inFile, outFile, jobs);
+				}
+
+				std::cout << "Decrypting " << jobs.size() << " files..." << std::endl;
+
+				const auto startTime = std::chrono::steady_clock::now();
+				auto totalSize = uint64_t(0);
+				const auto failedCount = decrypter.decryptFiles(jobs, &totalSize);
+				const auto elapsedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+				const auto totalSizeInMiB = static_cast<double>(totalSize) / 0x100000;
+				std::cout << boost::format("Decrypted %u files, %.1f MiB in %.2f s (%.1f MiB/s)")
+					% (jobs.size() - failedCount) % totalSizeInMiB % elapsedTime % (elapsedTime > 0 ? totalSizeInMiB / elapsedTime : 0.0) << std::endl;
+
+				if (failedCount != 0) {
+					std::cerr << "Unable to decrypt " << failedCount << " files." << std::endl;
+					return EXIT_FAILURE;
+				}
+
+				std::cout << "Done!" << std::endl;
+				return EXIT_SUCCESS;
+			}
+
+			if (inFile != FileDecrypter::STDIO_PATH && (!boost::filesystem::exists(inFile) || !boost::filesystem::is_regular_file(inFile))) {
 				std::cerr << "Invalid input file specified." << std::endl;
 				return EXIT_FAILURE;
 			}
-			if (boost::filesystem::exists(outFile) && !boost::filesystem::is_regular_file(outFile)) {
+			if (outFile != FileDecrypter::STDIO_PATH && boost::filesystem::exists(outFile) && !boost::filesystem::is_regular_file(outFile)) {
 				std::cerr << "Invalid output file specified." << std::endl;
 				return EXIT_FAILURE;
 			}
 
-			std::vector<uint8_t> data;
-			if (!loadFromFile(inFile, data)) {
-				std::cerr << "Unable to load input file." << std::endl;
-				return EXIT_FAILURE;
-			}
-
-			std::cout << "Decrypting file..." << std::endl;
+			// Decrypted data may go to stdout, so progress messages go to stderr in that case.
+			auto& log = (outFile == FileDecrypter::STDIO_PATH) ? std::cerr : std::cout;
 
-			Salsa20Cipher cipher(key, sizeof(key));
-			cipher.processBytes(data.data(), data.data(), data.size());
+			log << "Decrypting file..." << std::endl;
 
-			if (!saveToFile(outFile, data.data(), data.size())) {
-				std::cerr << "Unable to load input file." << std::endl;
+			if (!decrypter.decrypt(inFile, outFile)) {
+				std::cerr << "Unable to decrypt file." << std::endl;
 				return EXIT_FAILURE;
 			}
 
-			std::cout << "Done!" << std::endl;
+			log << "Done!" << std::endl;
 			return EXIT_SUCCESS;
 		} else if (varMap.count("unpack")) {
 			boost::program_options::variables_map restVarMap;
@@ -104,7 +304,7 @@ show_help:
 				boost::program_options::command_line_parser(restParams)
 					.style(boost::program_options::command_line_style::unix_style)
 					.allow_unregistered()
-					.options(decryptOpts)
+					.options(boost::program_options::options_description().add(unpackOpts).add(filterOpts))
 					.run(),
 				restVarMap
 			);
@@ -116,6 +316,29 @@ show_help:
 
 			const auto& inFile = restVarMap["input"].as<std::string>();
 			const auto& outDir = restVarMap["output"].as<std::string>();
+			const auto jobCount = restVarMap["jobs"].as<unsigned int>();
+			const auto useMemoryMapping = !restVarMap.count("no-mmap");
+			const auto useIoRing = !restVarMap.count("no-io-uring");
+			const auto streamChunkSize = static_cast<size_t>(restVarMap["chunk-size"].as<unsigned int>()) << 10;
+
+			auto tocCachePath = restVarMap.count("toc-cache") ? restVarMap["toc-cache"].as<std::string>() : std::string();
+			if (restVarMap.count("toc-cache") && tocCachePath.empty()) {
+				tocCachePath = inFile + ".toc";
+			}
+
+			VolumeFile::PipelineConfig pipelineConfig;
+			pipelineConfig.readerCount = restVarMap["read-threads"].as<unsigned int>();
+			pipelineConfig.decrypterCount = restVarMap["decrypt-threads"].as<unsigned int>();
+			pipelineConfig.inflaterCount = restVarMap["inflate-threads"].as<unsigned int>();
+			pipelineConfig.writerCount = restVarMap["write-threads"].as<unsigned int>();
+			pipelineConfig.maxInFlightSize = static_cast<uint64_t>(restVarMap["max-in-flight"].as<unsigned int>()) << 20;
+			pipelineConfig.maxReadGap = static_cast<uint64_t>(restVarMap["read-gap"].as<unsigned int>()) << 10;
+			pipelineConfig.maxReadSize = static_cast<uint64_t>(restVarMap["max-read-size"].as<unsigned int>()) << 10;
+
+			EntryFilter filter;
+			if (!setupEntryFilter(restVarMap, filter)) {
+				return EXIT_FAILURE;
+			}
 
 			if (!boost::filesystem::exists(inFile) || !boost::filesystem::is_regular_file(inFile)) {
 				std::cerr << "Invalid volume file specified." << std::endl;
@@ -126,12 +349,24 @@ show_help:
 				return EXIT_FAILURE;
 			}
 
+			std::unique_ptr<ThreadPool> threadPool;
+			if (jobCount != 1) {
+				threadPool.reset(new ThreadPool(jobCount));
+			}
+
 			GT5VolumeFile vol5;
 			GT6VolumeFile vol6;
 			GT7VolumeFile vol7;
 			std::array<VolumeFile*, 3> volumes = {{ &vol5, &vol6, &vol7 }};
 			VolumeFile* volume = nullptr;
 			for (auto vol: volumes) {
+				vol->setThreadPool(threadPool.get());
+				vol->setUseMemoryMapping(useMemoryMapping);
+				vol->setUseIoRing(useIoRing);
+				vol->setStreamChunkSize(streamChunkSize);
+				vol->setPipelineConfig(pipelineConfig);
+				vol->setTocCachePath(tocCachePath);
+				vol->setUsePathIndex(filter.selectsListedPathsOnly());
 				if (vol->load(inFile)) {
 					volume = vol;
 					break;
@@ -143,13 +378,114 @@ show_help:
 			}
 
 			std::cout << "Unpacking files..." << std::endl;
-			if (!volume->unpackAll(outDir)) {
+			const auto unpacked = filter.empty() ? volume->unpackAll(outDir) : volume->unpackSelected(outDir, filter);
+			if (!unpacked) {
 				std::cerr << "Unable to unpack volume file." << std::endl;
 				return EXIT_FAILURE;
 			}
 
 			std::cout << "Done!" << std::endl;
 			return EXIT_SUCCESS;
+		} else if (varMap.count("list")) {
+			boost::program_options::variables_map restVarMap;
+			boost::program_options::store(
+				boost::program_options::command_line_parser(restParams)
+					.style(boost::program_options::command_line_style::unix_style)
+					.allow_unregistered()
+					.options(boost::program_options::options_description().add(listOpts).add(filterOpts))
+					.run(),
+				restVarMap
+			);
+			boost::program_options::notify(restVarMap);
+
+			if (!restVarMap.count("input")) {
+				goto show_help;
+			}
+
+			const auto& inFile = restVarMap["input"].as<std::string>();
+			const auto& outFile = restVarMap["output"].as<std::string>();
+			const auto jobCount = restVarMap["jobs"].as<unsigned int>();
+			const auto useMemoryMapping = !restVarMap.count("no-mmap");
+
+			auto tocCachePath = restVarMap.count("toc-cache") ? restVarMap["toc-cache"].as<std::string>() : std::string();
+			if (restVarMap.count("toc-cache") && tocCachePath.empty()) {
+				tocCachePath = inFile + ".toc";
+			}
+
+			EntryLister::Format format;
+			if (!EntryLister::parseFormat(restVarMap["format"].as<std::string>(), format)) {
+				std::cerr << "Invalid record format specified." << std::endl;
+				return EXIT_FAILURE;
+			}
+
+			EntryFilter filter;
+			if (!setupEntryFilter(restVarMap, filter)) {
+				return EXIT_FAILURE;
+			}
+
+			if (!boost::filesystem::exists(inFile) || !boost::filesystem::is_regular_file(inFile)) {
+				std::cerr << "Invalid volume file specified." << std::endl;
+				return EXIT_FAILURE;
+			}
+
+			std::ofstream outStream;
+			if (outFile != FileDecrypter::STDIO_PATH) {
+				outStream.open(outFile, std::ios::out | std::ios::binary | std::ios::trunc);
+				if (!outStream) {
+					std::cerr << "Unable to create output file: " << outFile << std::endl;
+					return EXIT_FAILURE;
+				}
+			}
+
+			// Records may go to stdout, so any messages printed while loading go to stderr instead.
+			auto* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+			std::ostream stdoutStream(stdoutBuffer);
+			auto& recordStream = (outFile != FileDecrypter::STDIO_PATH) ? static_cast<std::ostream&>(outStream) : stdoutStream;
+
+			std::unique_ptr<ThreadPool> threadPool;
+			if (jobCount != 1) {
+				threadPool.reset(new ThreadPool(jobCount));
+			}
+
+			GT5VolumeFile vol5;
+			GT6VolumeFile vol6;
+			GT7VolumeFile vol7;
+			std::array<VolumeFile*, 3> volumes = {{ &vol5, &vol6, &vol7 }};
+			VolumeFile* volume = nullptr;
+			for (auto vol: volumes) {
+				vol->setThreadPool(threadPool.get());
+				vol->setUseMemoryMapping(useMemoryMapping);
+				vol->setTocCachePath(tocCachePath);
+				if (vol->load(inFile)) {
+					volume = vol;
+					break;
+				}
+			}
+
+			auto listed = false;
+			if (volume && volume->pathTable().empty()) {
+				std::cerr << "Unable to decode file entries of volume." << std::endl;
+			} else if (volume) {
+				if (filter.prepare(volume->pathTable())) {
+					const auto listTotals = restVarMap.count("totals") != 0;
+					const auto listDirectories = restVarMap.count("by-directory") != 0;
+
+					EntryLister lister(*volume);
+					lister.setFormat(format);
+					lister.setListFiles(!listTotals && !listDirectories);
+					lister.setListDirectories(listDirectories);
+					lister.setListTotals(listTotals);
+					listed = lister.list(recordStream, filter.empty() ? nullptr : &filter);
+				} else {
+					std::cerr << "Cannot find subtree root directory." << std::endl;
+				}
+			} else {
+				std::cerr << "Unable to load volume file." << std::endl;
+			}
+
+			std::cout.rdbuf(stdoutBuffer);
+
+			return listed ? EXIT_SUCCESS : EXIT_FAILURE;
 		} else {
 			goto show_help;
 		}
@@ -0,0 +1,147 @@
+#include "node_table.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+void NodeTable::clear()
+{
+	m_storage = Storage();
+
+	m_flags = Span<const uint8_t>();
+	m_size1 = m_size2 = Span<const uint32_t>();
+	m_volumeIndices = m_sectorIndices = Span<const uint32_t>();
+	m_positions = Span<const uint32_t>();
+
+	m_nodeCount = 0;
+}
+
+bool NodeTable::build(const NodeBTree& tree, ThreadPool* pool)
+{
+	clear();
+
+	std::vector<NodeBTree::NodeRef> nodes;
+	tree.collectNodes(nodes);
+
+	auto nodeCount = size_t(0);
+	for (const auto& node: nodes) {
+		nodeCount += node.keyCount;
+	}
+	if (nodeCount == 0) {
+		return false;
+	}
+
+	// Keys are sorted by node index, so the last one gives size of the table.
+	auto maxNodeIndex = 0u;
+	const auto lastNode = std::find_if(nodes.rbegin(), nodes.rend(), [](const NodeBTree::NodeRef& node) {
+		return node.keyCount != 0;
+	});
+	const auto maxVisitor = [&maxNodeIndex](unsigned int keyIndex, const NodeKey& key) {
+		maxNodeIndex = std::max(maxNodeIndex, key.nodeIndex());
+		return true;
+	};
+	tree.traverseNode(*lastNode, maxVisitor);
+
+	const auto slotCount = static_cast<size_t>(maxNodeIndex) + 1;
+	const auto maxUnusedSlotCount = (nodeCount > MAX_UNUSED_SLOT_COUNT) ? nodeCount : MAX_UNUSED_SLOT_COUNT;
+	if (slotCount < nodeCount || slotCount - nodeCount > maxUnusedSlotCount) {
+		return false;
+	}
+
+	auto& storage = m_storage;
+	storage.flags.resize(slotCount);
+	storage.size1.resize(slotCount);
+	storage.size2.resize(slotCount);
+	storage.volumeIndices.resize(slotCount);
+	storage.sectorIndices.resize(slotCount);
+	storage.positions.assign(slotCount, static_cast<uint32_t>(INVALID_INDEX));
+
+	std::atomic<bool> failed(false);
+
+	{
+		TaskGroup tasks(pool);
+
+		for (auto first = size_t(0); first < nodes.size(); first += NODES_PER_TASK) {
+			const auto last = std::min(first + NODES_PER_TASK, nodes.size());
+
+			tasks.run([&storage, &tree, &nodes, &failed, first, last, slotCount]() {
+				const auto visitor = [&storage, &failed, slotCount](unsigned int keyIndex, const NodeKey& key) {
+					const auto nodeIndex = key.nodeIndex();
+					if (nodeIndex >= slotCount) {
+						failed = true;
+						return false;
+					}
+
+					storage.flags[nodeIndex] = static_cast<uint8_t>(key.flags());
+					storage.size1[nodeIndex] = key.size1();
+					storage.size2[nodeIndex] = key.size2();
+					storage.volumeIndices[nodeIndex] = key.volumeIndex();
+					storage.sectorIndices[nodeIndex] = key.sectorIndex();
+					storage.positions[nodeIndex] = keyIndex;
+
+					return true;
+				};
+
+				for (auto i = first; i < last; ++i) {
+					tree.traverseNode(nodes[i], visitor);
+				}
+			});
+		}
+
+		tasks.wait();
+	}
+
+	if (failed) {
+		clear();
+		return false;
+	}
+
+	m_flags = Span<const uint8_t>(storage.flags.data(), slotCount);
+	m_size1 = Span<const uint32_t>(storage.size1.data(), slotCount);
+	m_size2 = Span<const uint32_t>(storage.size2.data(), slotCount);
+	m_volumeIndices = Span<const uint32_t>(storage.volumeIndices.data(), slotCount);
+	m_sectorIndices = Span<const uint32_t>(storage.sectorIndices.data(), slotCount);
+	m_positions = Span<const uint32_t>(storage.positions.data(), slotCount);
+	m_nodeCount = nodeCount;
+
+	return true;
+}
+
+void NodeTable::save(ByteBuffer& image) const
+{
+	const uint64_t counts[] = { m_positions.size(), m_nodeCount };
+
+	image.clear();
+	appendImageArray(image, counts, 2);
+	appendImageArray(image, m_flags.data(), m_flags.size());
+	appendImageArray(image, m_size1.data(), m_size1.size());
+	appendImageArray(image, m_size2.data(), m_size2.size());
+	appendImageArray(image, m_volumeIndices.data(), m_volumeIndices.size());
+	appendImageArray(image, m_sectorIndices.data(), m_sectorIndices.size());
+	appendImageArray(image, m_positions.data(), m_positions.size());
+}
+
+bool NodeTable::load(ConstByteSpan image)
+{
+	clear();
+
+	Span<const uint64_t> counts;
+	if (!viewImageArray(image, 2, counts) || counts[1] > counts[0]) {
+		return false;
+	}
+
+	const auto slotCount = counts[0];
+	const auto result = viewImageArray(image, slotCount, m_flags)
+		&& viewImageArray(image, slotCount, m_size1)
+		&& viewImageArray(image, slotCount, m_size2)
+		&& viewImageArray(image, slotCount, m_volumeIndices)
+		&& viewImageArray(image, slotCount, m_sectorIndices)
+		&& viewImageArray(image, slotCount, m_positions);
+	if (!result) {
+		clear();
+		return false;
+	}
+
+	m_nodeCount = static_cast<size_t>(counts[1]);
+
+	return true;
+}
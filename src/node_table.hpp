@@ -0,0 +1,97 @@
+#pragma once
+
+#include "btree.hpp"
+#include "flat_image.hpp"
+#include "thread_pool.hpp"
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Node tree decoded once into columns indexed by node index, so a node is found by an array access and scans over a single
+// field (e.g. sizes of all nodes) touch only that field. Nodes of the tree are decoded in parallel.
+class NodeTable
+	: private boost::noncopyable
+{
+public:
+	static const auto INVALID_INDEX = ~0u;
+
+	NodeTable()
+		: m_nodeCount(0)
+	{
+	}
+
+	void clear();
+
+	bool empty() const { return m_positions.empty(); }
+
+	// Number of slots, i.e. the highest node index plus one. Slots of node indices missing in the tree are unused.
+	size_t size() const { return m_positions.size(); }
+	size_t nodeCount() const { return m_nodeCount; }
+
+	// Fails if node indices are too sparse for a table indexed by them.
+	bool build(const NodeBTree& tree, ThreadPool* pool);
+
+	// Flat image of the columns, a loaded table views the image in place, so the image must outlive it. Image of an empty
+	// table is loaded as well, so a table which could not be built is not built again.
+	void save(ByteBuffer& image) const;
+	bool load(ConstByteSpan image);
+
+	bool contains(uint32_t nodeIndex) const
+	{
+		return nodeIndex < m_positions.size() && m_positions[nodeIndex] != INVALID_INDEX;
+	}
+
+	// Returns index of the node in the tree (as NodeBTree::searchByKey() does) or INVALID_INDEX if there is no such node.
+	unsigned int find(uint32_t nodeIndex, NodeKey& nodeKey) const
+	{
+		if (!contains(nodeIndex)) {
+			return INVALID_INDEX;
+		}
+
+		nodeKey = NodeKey(nodeIndex);
+		nodeKey
+			.setFlags(m_flags[nodeIndex])
+			.setSize1(m_size1[nodeIndex])
+			.setSize2(m_size2[nodeIndex])
+			.setVolumeIndex(m_volumeIndices[nodeIndex])
+			.setSectorIndex(m_sectorIndices[nodeIndex]);
+
+		return m_positions[nodeIndex];
+	}
+
+	Span<const uint8_t> flags() const { return m_flags; }
+	Span<const uint32_t> size1() const { return m_size1; }
+	Span<const uint32_t> size2() const { return m_size2; }
+	Span<const uint32_t> volumeIndices() const { return m_volumeIndices; }
+	Span<const uint32_t> sectorIndices() const { return m_sectorIndices; }
+	Span<const uint32_t> positions() const { return m_positions; }
+
+private:
+	static const auto NODES_PER_TASK = size_t(64);
+	static const auto MAX_UNUSED_SLOT_COUNT = size_t(0x10000);
+
+	// Columns view either the own storage or a loaded image.
+	struct Storage
+	{
+		std::vector<uint8_t> flags;
+		std::vector<uint32_t> size1;
+		std::vector<uint32_t> size2;
+		std::vector<uint32_t> volumeIndices;
+		std::vector<uint32_t> sectorIndices;
+		std::vector<uint32_t> positions;
+	};
+
+	Storage m_storage;
+
+	Span<const uint8_t> m_flags;
+	Span<const uint32_t> m_size1;
+	Span<const uint32_t> m_size2;
+	Span<const uint32_t> m_volumeIndices;
+	Span<const uint32_t> m_sectorIndices;
+
+	// Index of the node in the tree, INVALID_INDEX marks unused slots.
+	Span<const uint32_t> m_positions;
+
+	size_t m_nodeCount;
+};
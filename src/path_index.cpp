@@ -0,0 +1,147 @@
+#include "path_index.hpp"
+
+#include <cstring>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<NodeKey>::value, "node keys are copied into index images as is");
+
+void PathIndex::clear()
+{
+	m_paths.clear();
+	m_entries.clear();
+	m_nodeKeys.clear();
+	m_slots.clear();
+	m_pathView = Span<const char>();
+	m_entryView = Span<const Entry>();
+	m_nodeKeyView = Span<const NodeKey>();
+	m_slotView = Span<const uint32_t>();
+	m_mask = 0;
+}
+
+void PathIndex::reserve(size_t count)
+{
+	m_entries.reserve(count);
+	m_nodeKeys.reserve(count);
+}
+
+void PathIndex::add(const char* path, size_t pathLength, const NodeKey& nodeKey, unsigned int nodeIndex)
+{
+	m_entries.push_back({ hashPath(path, pathLength), static_cast<uint32_t>(m_paths.size()), static_cast<uint32_t>(pathLength), nodeIndex });
+	m_nodeKeys.push_back(nodeKey);
+	m_paths.insert(m_paths.end(), path, path + pathLength);
+}
+
+void PathIndex::finalize()
+{
+	m_paths.shrink_to_fit();
+	m_entries.shrink_to_fit();
+	m_nodeKeys.shrink_to_fit();
+
+	// Table is kept at most half full, so probe sequences of misses stay short too.
+	auto slotCount = size_t(16);
+	while (slotCount < m_entries.size() * 2) {
+		slotCount <<= 1;
+	}
+	m_slots.assign(slotCount, 0);
+	m_mask = slotCount - 1;
+
+	for (auto i = size_t(0); i < m_entries.size(); ++i) {
+		auto slot = static_cast<size_t>(m_entries[i].hash) & m_mask;
+		while (m_slots[slot] != 0) {
+			slot = (slot + 1) & m_mask;
+		}
+		m_slots[slot] = static_cast<uint32_t>(i + 1);
+	}
+
+	m_pathView = Span<const char>(m_paths.data(), m_paths.size());
+	m_entryView = Span<const Entry>(m_entries.data(), m_entries.size());
+	m_nodeKeyView = Span<const NodeKey>(m_nodeKeys.data(), m_nodeKeys.size());
+	m_slotView = Span<const uint32_t>(m_slots.data(), m_slots.size());
+}
+
+unsigned int PathIndex::find(const char* path, size_t pathLength, NodeKey& nodeKey) const
+{
+	if (m_slotView.empty()) {
+		return NodeBTree::INVALID_INDEX;
+	}
+
+	const auto hash = hashPath(path, pathLength);
+	for (auto slot = static_cast<size_t>(hash) & m_mask; m_slotView[slot] != 0; slot = (slot + 1) & m_mask) {
+		const auto entryIndex = m_slotView[slot] - 1;
+		const auto& entry = m_entryView[entryIndex];
+		if (entry.hash != hash || entry.pathLength != pathLength) {
+			continue;
+		}
+		if (std::memcmp(m_pathView.data() + entry.pathOffset, path, pathLength) != 0) {
+			continue;
+		}
+
+		nodeKey = m_nodeKeyView[entryIndex];
+		return entry.nodeIndex;
+	}
+
+	return NodeBTree::INVALID_INDEX;
+}
+
+void PathIndex::save(ByteBuffer& image) const
+{
+	const uint64_t counts[] = { m_pathView.size(), m_entryView.size(), m_slotView.size() };
+
+	image.clear();
+	appendImageArray(image, counts, 3);
+	appendImageArray(image, m_pathView.data(), m_pathView.size());
+	appendImageArray(image, m_entryView.data(), m_entryView.size());
+	appendImageArray(image, m_nodeKeyView.data(), m_nodeKeyView.size());
+	appendImageArray(image, m_slotView.data(), m_slotView.size());
+}
+
+bool PathIndex::load(ConstByteSpan image)
+{
+	clear();
+
+	Span<const uint64_t> counts;
+	if (!viewImageArray(image, 3, counts)) {
+		return false;
+	}
+
+	// Slot count must be a power of two bigger than the entry count, otherwise probing never stops.
+	const auto entryCount = counts[1], slotCount = counts[2];
+	if (entryCount == 0 || entryCount >= slotCount || (slotCount & (slotCount - 1)) != 0) {
+		return false;
+	}
+
+	if (!viewImageArray(image, counts[0], m_pathView) || !viewImageArray(image, entryCount, m_entryView)
+		|| !viewImageArray(image, entryCount, m_nodeKeyView) || !viewImageArray(image, slotCount, m_slotView)) {
+		clear();
+		return false;
+	}
+
+	for (const auto& entry: m_entryView) {
+		if (entry.pathOffset > m_pathView.size() || entry.pathLength > m_pathView.size() - entry.pathOffset) {
+			clear();
+			return false;
+		}
+	}
+	for (const auto slot: m_slotView) {
+		if (slot > m_entryView.size()) {
+			clear();
+			return false;
+		}
+	}
+
+	m_mask = m_slotView.size() - 1;
+
+	return true;
+}
+
+uint64_t PathIndex::hashPath(const char* path, size_t pathLength)
+{
+	// FNV-1a, paths are short so a simple bytewise hash is enough.
+	auto hash = UINT64_C(0xCBF29CE484222325);
+	for (auto i = size_t(0); i < pathLength; ++i) {
+		hash ^= static_cast<uint8_t>(path[i]);
+		hash *= UINT64_C(0x100000001B3);
+	}
+
+	return hash;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "btree.hpp"
+#include "flat_image.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Hash index from full file path to node, it is built once from the entry trees and then answers both hits and misses without
+// descending any tree. Paths are kept back to back in a single character array and the table holds only entry numbers.
+class PathIndex
+	: private boost::noncopyable
+{
+public:
+	PathIndex()
+		: m_mask(0)
+	{
+	}
+
+	void clear();
+
+	bool empty() const { return m_entryView.empty(); }
+	size_t size() const { return m_entryView.size(); }
+
+	void reserve(size_t count);
+
+	// Paths must be unique, the table is rebuilt by finalize() which has to be called before any lookup.
+	void add(const char* path, size_t pathLength, const NodeKey& nodeKey, unsigned int nodeIndex);
+	void finalize();
+
+	// Returns NodeBTree::INVALID_INDEX if the path is unknown.
+	unsigned int find(const char* path, size_t pathLength, NodeKey& nodeKey) const;
+
+	unsigned int find(const std::string& path, NodeKey& nodeKey) const
+	{
+		return find(path.c_str(), path.size(), nodeKey);
+	}
+
+	// Flat image of a finalized index, a loaded index views the image in place without rehashing, so the image must outlive it.
+	void save(ByteBuffer& image) const;
+	bool load(ConstByteSpan image);
+
+	static uint64_t hashPath(const char* path, size_t pathLength);
+
+private:
+	struct Entry
+	{
+		uint64_t hash;
+		uint32_t pathOffset;
+		uint32_t pathLength;
+		uint32_t nodeIndex;
+	};
+
+	// Views either the own arrays or a loaded image.
+	std::vector<char> m_paths;
+	std::vector<Entry> m_entries;
+	std::vector<NodeKey> m_nodeKeys;
+	Span<const char> m_pathView;
+	Span<const Entry> m_entryView;
+	Span<const NodeKey> m_nodeKeyView;
+
+	// Open addressing with linear probing, zero marks an empty slot and other values are entry numbers plus one.
+	std::vector<uint32_t> m_slots;
+	Span<const uint32_t> m_slotView;
+	size_t m_mask;
+};
@@ -0,0 +1,235 @@
+#include "path_table.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+void StringTable::clear()
+{
+	m_chars.clear();
+	m_offsets.clear();
+	m_charView = Span<const char>();
+	m_offsetView = Span<const uint32_t>();
+}
+
+void StringTable::build(const StringBTree& tree)
+{
+	clear();
+
+	m_offsets.push_back(0);
+
+	// Keys are visited in index order.
+	const auto visitor = [this](const StringKey& key) {
+		m_chars.insert(m_chars.end(), key.value(), key.value() + key.length());
+		m_offsets.push_back(static_cast<uint32_t>(m_chars.size()));
+		return true;
+	};
+	tree.traverse(visitor);
+
+	m_chars.shrink_to_fit();
+	m_offsets.shrink_to_fit();
+
+	m_charView = Span<const char>(m_chars.data(), m_chars.size());
+	m_offsetView = Span<const uint32_t>(m_offsets.data(), m_offsets.size());
+}
+
+void StringTable::save(ByteBuffer& image) const
+{
+	const uint64_t counts[] = { m_charView.size(), m_offsetView.size() };
+
+	appendImageArray(image, counts, 2);
+	appendImageArray(image, m_charView.data(), m_charView.size());
+	appendImageArray(image, m_offsetView.data(), m_offsetView.size());
+}
+
+bool StringTable::load(ConstByteSpan& image)
+{
+	clear();
+
+	Span<const uint64_t> counts;
+	if (!viewImageArray(image, 2, counts) || !viewImageArray(image, counts[0], m_charView) || !viewImageArray(image, counts[1], m_offsetView)) {
+		clear();
+		return false;
+	}
+
+	// Offsets have to grow within the characters, otherwise lengths would wrap around.
+	auto prevOffset = 0u;
+	for (const auto offset: m_offsetView) {
+		if (offset < prevOffset || offset > m_charView.size()) {
+			clear();
+			return false;
+		}
+		prevOffset = offset;
+	}
+
+	return true;
+}
+
+void PathTable::clear()
+{
+	m_names.clear();
+	m_extensions.clear();
+	m_entryKeys.clear();
+	m_entries.clear();
+	m_paths.clear();
+	m_entryView = Span<const Entry>();
+	m_pathView = Span<const char>();
+}
+
+bool PathTable::build(const uint8_t* toc, uint32_t nameTreeOffset, uint32_t extTreeOffset, const std::vector<uint32_t>& entryTreeOffsets, ThreadPool* pool)
+{
+	clear();
+
+	if (entryTreeOffsets.empty()) {
+		return false;
+	}
+
+	m_entryKeys.resize(entryTreeOffsets.size());
+
+	{
+		TaskGroup tasks(pool);
+
+		tasks.run([this, toc, nameTreeOffset]() {
+			m_names.build(StringBTree(advancePointer(toc, nameTreeOffset)));
+		});
+		tasks.run([this, toc, extTreeOffset]() {
+			m_extensions.build(StringBTree(advancePointer(toc, extTreeOffset)));
+		});
+
+		for (auto i = size_t(0); i < entryTreeOffsets.size(); ++i) {
+			tasks.run([this, toc, &entryTreeOffsets, i]() {
+				auto& keys = m_entryKeys[i];
+				const auto visitor = [&keys](const EntryKey& key) {
+					keys.push_back(key);
+					return true;
+				};
+				EntryBTree(advancePointer(toc, entryTreeOffsets[i])).traverse(visitor);
+			});
+		}
+
+		tasks.wait();
+	}
+
+	auto entryCount = size_t(0);
+	for (const auto& keys: m_entryKeys) {
+		entryCount += keys.size();
+	}
+	m_entries.reserve(entryCount);
+
+	std::vector<bool> visitedTrees(m_entryKeys.size(), false);
+	const auto result = addEntries(0, NO_PARENT, visitedTrees);
+
+	std::vector<std::vector<EntryKey>>().swap(m_entryKeys);
+
+	if (!result) {
+		clear();
+		return false;
+	}
+
+	m_entries.shrink_to_fit();
+	m_paths.shrink_to_fit();
+
+	m_entryView = Span<const Entry>(m_entries.data(), m_entries.size());
+	m_pathView = Span<const char>(m_paths.data(), m_paths.size());
+
+	return true;
+}
+
+void PathTable::save(ByteBuffer& image) const
+{
+	const uint64_t counts[] = { m_entryView.size(), m_pathView.size() };
+
+	image.clear();
+	appendImageArray(image, counts, 2);
+	m_names.save(image);
+	m_extensions.save(image);
+	appendImageArray(image, m_entryView.data(), m_entryView.size());
+	appendImageArray(image, m_pathView.data(), m_pathView.size());
+}
+
+bool PathTable::load(ConstByteSpan image)
+{
+	clear();
+
+	Span<const uint64_t> counts;
+	if (!viewImageArray(image, 2, counts) || !m_names.load(image) || !m_extensions.load(image)) {
+		clear();
+		return false;
+	}
+	if (!viewImageArray(image, counts[0], m_entryView) || !viewImageArray(image, counts[1], m_pathView)) {
+		clear();
+		return false;
+	}
+
+	// Parents precede their contents, so parent links can't form a loop.
+	for (auto i = size_t(0); i < m_entryView.size(); ++i) {
+		const auto& entry = m_entryView[i];
+		if (entry.pathOffset > m_pathView.size() || entry.pathLength > m_pathView.size() - entry.pathOffset) {
+			clear();
+			return false;
+		}
+		if (entry.parentIndex != NO_PARENT && entry.parentIndex >= i) {
+			clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool PathTable::addEntries(uint32_t entryTreeIndex, uint32_t parentIndex, std::vector<bool>& visitedTrees)
+{
+	// Trees on the current walk are marked, so malformed links can't make it loop forever.
+	if (entryTreeIndex >= m_entryKeys.size() || visitedTrees[entryTreeIndex]) {
+		return false;
+	}
+	visitedTrees[entryTreeIndex] = true;
+
+	for (const auto& key: m_entryKeys[entryTreeIndex]) {
+		const auto parentPathOffset = (parentIndex != NO_PARENT) ? m_entries[parentIndex].pathOffset : 0;
+		const auto parentPathLength = (parentIndex != NO_PARENT) ? m_entries[parentIndex].pathLength : 0;
+
+		const auto pathOffset = m_paths.size();
+		if (pathOffset + parentPathLength > UINT32_MAX) {
+			return false;
+		}
+
+		// Parent path is copied by offset because the array may be reallocated by the resize.
+		m_paths.resize(pathOffset + parentPathLength);
+		std::memcpy(m_paths.data() + pathOffset, m_paths.data() + parentPathOffset, parentPathLength);
+		appendComponent(key);
+
+		const auto pathLength = m_paths.size() - pathOffset;
+		if (pathLength == 0 || m_paths.size() > UINT32_MAX) {
+			return false;
+		}
+
+		const auto entryIndex = static_cast<uint32_t>(m_entries.size());
+		m_entries.push_back({ key, parentIndex, static_cast<uint32_t>(pathOffset), static_cast<uint32_t>(pathLength) });
+
+		if (key.isDirectory() && !addEntries(key.linkIndex(), entryIndex, visitedTrees)) {
+			return false;
+		}
+	}
+
+	visitedTrees[entryTreeIndex] = false;
+
+	return true;
+}
+
+void PathTable::appendComponent(const EntryKey& key)
+{
+	const char* value;
+	uint32_t length;
+
+	if (m_names.get(key.nameIndex(), value, length)) {
+		m_paths.insert(m_paths.end(), value, value + length);
+	}
+
+	if (key.isFile()) {
+		if (m_extensions.get(key.extIndex(), value, length)) {
+			m_paths.insert(m_paths.end(), value, value + length);
+		}
+	} else if (key.isDirectory()) {
+		m_paths.push_back('/');
+	}
+}
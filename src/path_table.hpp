@@ -0,0 +1,112 @@
+#pragma once
+
+#include "btree.hpp"
+#include "flat_image.hpp"
+#include "thread_pool.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// All strings of a string tree decoded once into a single character array, so a string is found by its index without
+// descending the tree.
+class StringTable
+	: private boost::noncopyable
+{
+public:
+	void clear();
+
+	bool empty() const { return m_offsetView.size() < 2; }
+	size_t size() const { return empty() ? 0 : m_offsetView.size() - 1; }
+
+	void build(const StringBTree& tree);
+
+	// Appends flat image of the table to the buffer.
+	void save(ByteBuffer& image) const;
+	// Views the table in the front of the image and moves past it, the image must outlive the table.
+	bool load(ConstByteSpan& image);
+
+	// Returns false if there is no string with such index.
+	bool get(uint32_t index, const char*& value, uint32_t& length) const
+	{
+		if (index >= size()) {
+			return false;
+		}
+
+		value = m_charView.data() + m_offsetView[index];
+		length = m_offsetView[index + 1] - m_offsetView[index];
+
+		return true;
+	}
+
+private:
+	// Views either the own arrays or a loaded image.
+	std::vector<char> m_chars;
+	std::vector<uint32_t> m_offsets;
+	Span<const char> m_charView;
+	Span<const uint32_t> m_offsetView;
+};
+
+// Flat table of all entries of a volume with their full paths, entries are stored in the same order as a depth-first walk of
+// entry trees visits them (i.e. a directory is followed by its contents). Entry trees and string trees are decoded in parallel
+// and then paths are assembled in a single pass, each from the path of its parent.
+class PathTable
+	: private boost::noncopyable
+{
+public:
+	static const auto NO_PARENT = ~0u;
+
+	struct Entry
+	{
+		EntryKey key;
+
+		// Index of the directory entry which contains this entry.
+		uint32_t parentIndex;
+
+		// Directory paths end with a separator.
+		uint32_t pathOffset;
+		uint32_t pathLength;
+	};
+
+	void clear();
+
+	bool empty() const { return m_entryView.empty(); }
+	size_t size() const { return m_entryView.size(); }
+
+	const Entry& operator [](size_t index) const { return m_entryView[index]; }
+
+	const Entry* begin() const { return m_entryView.begin(); }
+	const Entry* end() const { return m_entryView.end(); }
+
+	const char* pathData(const Entry& entry) const { return m_pathView.data() + entry.pathOffset; }
+	std::string path(const Entry& entry) const { return std::string(pathData(entry), entry.pathLength); }
+
+	const StringTable& names() const { return m_names; }
+	const StringTable& extensions() const { return m_extensions; }
+
+	// Trees are given by their offsets within the TOC, if pool is given then trees are decoded on it.
+	bool build(const uint8_t* toc, uint32_t nameTreeOffset, uint32_t extTreeOffset, const std::vector<uint32_t>& entryTreeOffsets, ThreadPool* pool);
+
+	// Flat image of the table, a loaded table views the image in place, so the image must outlive it. Image of an empty table
+	// is loaded as well, so a table which could not be built is not built again.
+	void save(ByteBuffer& image) const;
+	bool load(ConstByteSpan image);
+
+private:
+	bool addEntries(uint32_t entryTreeIndex, uint32_t parentIndex, std::vector<bool>& visitedTrees);
+
+	void appendComponent(const EntryKey& key);
+
+	StringTable m_names;
+	StringTable m_extensions;
+
+	// Decoded keys of each entry tree, they are needed only while the table is built.
+	std::vector<std::vector<EntryKey>> m_entryKeys;
+
+	// Views either the own arrays or a loaded image.
+	std::vector<Entry> m_entries;
+	std::vector<char> m_paths;
+	Span<const Entry> m_entryView;
+	Span<const char> m_pathView;
+};
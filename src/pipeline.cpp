@@ -0,0 +1,53 @@
+#include "pipeline.hpp"
+
+void ByteBudget::acquire(uint64_t size)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cond.wait(lock, [this, size]() { return m_used == 0 || m_used + size <= m_limit; });
+	m_used += size;
+}
+
+void ByteBudget::charge(uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_used += size;
+}
+
+void ByteBudget::release(uint64_t size)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_used = (size < m_used) ? (m_used - size) : 0;
+	}
+	m_cond.notify_all();
+}
+
+PipelineStage::PipelineStage(unsigned int threadCount, Func func, Func onFinish)
+	: m_activeCount((threadCount != 0) ? threadCount : 1)
+{
+	const auto count = m_activeCount.load();
+
+	m_threads.reserve(count);
+	for (auto i = 0u; i < count; ++i) {
+		m_threads.emplace_back([this, func, onFinish]() {
+			func();
+			if (--m_activeCount == 0 && onFinish) {
+				onFinish();
+			}
+		});
+	}
+}
+
+PipelineStage::~PipelineStage()
+{
+	join();
+}
+
+void PipelineStage::join()
+{
+	for (auto& thread: m_threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Blocking FIFO of limited capacity connecting two pipeline stages, once closed pushes are refused and pops drain what is left.
+template<typename T>
+class BoundedQueue
+	: private boost::noncopyable
+{
+public:
+	explicit BoundedQueue(size_t capacity)
+		: m_capacity((capacity != 0) ? capacity : 1)
+		, m_closed(false)
+	{
+	}
+
+	// Waits while queue is full, returns false if queue was closed.
+	bool push(T&& value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFullCond.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+		if (m_closed) {
+			return false;
+		}
+		m_items.push_back(std::move(value));
+		lock.unlock();
+
+		m_notEmptyCond.notify_one();
+
+		return true;
+	}
+
+	// Waits while queue is empty, returns false if queue was closed and nothing is left.
+	bool pop(T& value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmptyCond.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+		if (m_items.empty()) {
+			return false;
+		}
+		value = std::move(m_items.front());
+		m_items.pop_front();
+		lock.unlock();
+
+		m_notFullCond.notify_one();
+
+		return true;
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+		m_notEmptyCond.notify_all();
+		m_notFullCond.notify_all();
+	}
+
+private:
+	const size_t m_capacity;
+
+	std::mutex m_mutex;
+	std::condition_variable m_notEmptyCond;
+	std::condition_variable m_notFullCond;
+	std::deque<T> m_items;
+
+	bool m_closed;
+};
+
+// Caps the number of bytes held by all stages of a pipeline together.
+class ByteBudget
+	: private boost::noncopyable
+{
+public:
+	explicit ByteBudget(uint64_t limit)
+		: m_limit(limit)
+		, m_used(0)
+	{
+	}
+
+	// Waits until size fits into the budget, a request bigger than the whole budget is granted once nothing else is held.
+	void acquire(uint64_t size);
+
+	// Takes size without waiting, it is used by later stages whose buffers grow so they can't be stalled by earlier ones.
+	void charge(uint64_t size);
+
+	void release(uint64_t size);
+
+	uint64_t limit() const { return m_limit; }
+
+private:
+	const uint64_t m_limit;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	uint64_t m_used;
+};
+
+// Runs a stage loop on its own threads and calls the completion handler (e.g. closing of the next queue) after the last one returns.
+class PipelineStage
+	: private boost::noncopyable
+{
+public:
+	typedef std::function<void()> Func;
+
+	PipelineStage(unsigned int threadCount, Func func, Func onFinish);
+	~PipelineStage();
+
+	void join();
+
+private:
+	std::vector<std::thread> m_threads;
+	std::atomic<unsigned int> m_activeCount;
+};
@@ -0,0 +1,162 @@
+#include "thread_pool.hpp"
+
+#include <chrono>
+
+static thread_local const ThreadPool* t_currentPool = nullptr;
+static thread_local unsigned int t_currentIndex = 0;
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: m_pendingCount(0)
+	, m_nextQueue(0)
+	, m_stop(false)
+{
+	if (threadCount == 0) {
+		threadCount = defaultThreadCount();
+	}
+
+	m_queues.reserve(threadCount);
+	for (auto i = 0u; i < threadCount; ++i) {
+		m_queues.emplace_back(new WorkQueue());
+	}
+
+	m_workers.reserve(threadCount);
+	for (auto i = 0u; i < threadCount; ++i) {
+		m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+
+	for (auto& worker: m_workers) {
+		worker.join();
+	}
+}
+
+unsigned int ThreadPool::defaultThreadCount()
+{
+	const auto count = std::thread::hardware_concurrency();
+	return (count != 0) ? count : 1;
+}
+
+void ThreadPool::submit(Task task)
+{
+	// Tasks spawned by a worker go to its own queue so they stay hot in its cache, others are spread in round-robin order.
+	const auto index = (t_currentPool == this)
+		? t_currentIndex
+		: (m_nextQueue++ % static_cast<unsigned int>(m_queues.size()))
+	;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_pendingCount;
+	}
+
+	{
+		auto& queue = *m_queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	m_cond.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+	const auto index = (t_currentPool == this) ? t_currentIndex : (m_nextQueue.load() % static_cast<unsigned int>(m_queues.size()));
+
+	Task task;
+	if (!popTask(index, task)) {
+		return false;
+	}
+
+	task();
+
+	return true;
+}
+
+bool ThreadPool::popTask(unsigned int index, Task& task)
+{
+	const auto queueCount = static_cast<unsigned int>(m_queues.size());
+
+	for (auto i = 0u; i < queueCount; ++i) {
+		const auto stealing = (i != 0);
+		auto& queue = *m_queues[(index + i) % queueCount];
+
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+
+		if (stealing) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		} else {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+
+		--m_pendingCount;
+
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+	t_currentPool = this;
+	t_currentIndex = index;
+
+	for (;;) {
+		Task task;
+		if (popTask(index, task)) {
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this]() { return m_stop || m_pendingCount.load() != 0; });
+		if (m_stop && m_pendingCount.load() == 0) {
+			break;
+		}
+	}
+}
+
+void TaskGroup::wait()
+{
+	if (m_pool) {
+		while (m_pendingCount.load() != 0) {
+			if (m_pool->runPendingTask()) {
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait_for(lock, std::chrono::milliseconds(1), [this]() { return m_pendingCount.load() == 0; });
+		}
+	}
+
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		exception = m_exception;
+		m_exception = nullptr;
+	}
+	if (exception) {
+		std::rethrow_exception(exception);
+	}
+}
+
+void TaskGroup::finish()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (--m_pendingCount == 0) {
+		m_cond.notify_all();
+	}
+}
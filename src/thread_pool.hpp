@@ -0,0 +1,116 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Work-stealing thread pool: each worker owns a deque, pops its own tasks from the back and steals from the front of others.
+class ThreadPool
+	: private boost::noncopyable
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	void submit(Task task);
+
+	// Runs one pending task on the calling thread, returns false if there was nothing to run.
+	bool runPendingTask();
+
+	unsigned int threadCount() const { return static_cast<unsigned int>(m_workers.size()); }
+
+	static unsigned int defaultThreadCount();
+
+private:
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void workerLoop(unsigned int index);
+
+	bool popTask(unsigned int index, Task& task);
+
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+
+	std::atomic<size_t> m_pendingCount;
+	std::atomic<unsigned int> m_nextQueue;
+
+	bool m_stop;
+};
+
+// Tracks a set of tasks submitted to a pool, if no pool is given then tasks are run immediately on the calling thread.
+class TaskGroup
+	: private boost::noncopyable
+{
+public:
+	explicit TaskGroup(ThreadPool* pool)
+		: m_pool(pool)
+		, m_pendingCount(0)
+	{
+	}
+
+	~TaskGroup()
+	{
+		try {
+			wait();
+		}
+		catch (...) {
+		}
+	}
+
+	template<typename Func>
+	void run(Func&& func)
+	{
+		if (!m_pool) {
+			func();
+			return;
+		}
+
+		++m_pendingCount;
+
+		m_pool->submit([this, func]() {
+			try {
+				func();
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_exception) {
+					m_exception = std::current_exception();
+				}
+			}
+			finish();
+		});
+	}
+
+	// Waits for completion of all tasks and helps to execute pending tasks meanwhile, rethrows the first task exception.
+	void wait();
+
+private:
+	void finish();
+
+	ThreadPool* m_pool;
+
+	std::atomic<size_t> m_pendingCount;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::exception_ptr m_exception;
+};
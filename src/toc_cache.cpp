@@ -0,0 +1,131 @@
+#include "toc_cache.hpp"
+#include "crc.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+
+bool TocCache::open(const std::string& filePath, const Key& key)
+{
+	close();
+
+	if (!m_file.open(filePath)) {
+		return false;
+	}
+
+	const auto fileSize = m_file.size();
+	if (fileSize < sizeof(Header) || fileSize > SIZE_MAX) {
+		close();
+		return false;
+	}
+
+	ConstByteSpan data;
+	if (m_file.map()) {
+		data = m_file.viewAt(0, static_cast<size_t>(fileSize));
+	} else {
+		m_buffer.resize(static_cast<size_t>(fileSize));
+		if (!m_file.readAt(0, m_buffer.data(), m_buffer.size())) {
+			close();
+			return false;
+		}
+		data = makeSpan(m_buffer);
+	}
+
+	Header header;
+	std::memcpy(&header, data.data(), sizeof(header));
+
+	if (header.magic != MAGIC || header.version != VERSION) {
+		close();
+		return false;
+	}
+	if (header.volumeSize != key.volumeSize || header.volumeTime != key.volumeTime || header.headerHash != key.headerHash) {
+		close();
+		return false;
+	}
+
+	const auto isInside = [fileSize](const SectionDesc& section) {
+		return section.offset >= sizeof(Header) && section.offset <= fileSize && section.size <= fileSize - section.offset;
+	};
+	if (header.toc.size == 0 || !isInside(header.toc) || !isInside(header.pathIndex) || !isInside(header.pathTable) || !isInside(header.nodeTable)) {
+		close();
+		return false;
+	}
+
+	const auto payloadHash = crc32_0x04C11DB7(data.data() + sizeof(Header), data.size() - sizeof(Header), 0);
+	if (payloadHash != header.payloadHash) {
+		close();
+		return false;
+	}
+
+	const auto view = [&data](const SectionDesc& section) {
+		return data.subspan(static_cast<size_t>(section.offset), static_cast<size_t>(section.size));
+	};
+	m_sections.toc = view(header.toc);
+	m_sections.pathIndex = view(header.pathIndex);
+	m_sections.pathTable = view(header.pathTable);
+	m_sections.nodeTable = view(header.nodeTable);
+
+	return true;
+}
+
+void TocCache::close()
+{
+	m_sections = Sections();
+
+	ByteBuffer().swap(m_buffer);
+	m_file.close();
+}
+
+bool TocCache::save(const std::string& filePath, const Key& key, const Sections& sections)
+{
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.headerHash = key.headerHash;
+	header.volumeSize = key.volumeSize;
+	header.volumeTime = key.volumeTime;
+
+	// Sections follow each other in the order of the header.
+	auto dataSize = static_cast<uint64_t>(sizeof(Header));
+	const auto place = [&dataSize](SectionDesc& desc, ConstByteSpan section) {
+		desc.offset = alignUp(dataSize, SECTION_ALIGNMENT);
+		desc.size = section.size();
+		dataSize = desc.offset + desc.size;
+	};
+	place(header.toc, sections.toc);
+	place(header.pathIndex, sections.pathIndex);
+	place(header.pathTable, sections.pathTable);
+	place(header.nodeTable, sections.nodeTable);
+
+	ByteBuffer data(static_cast<size_t>(dataSize));
+	std::memset(data.data(), 0, data.size());
+
+	const auto copy = [&data](const SectionDesc& desc, ConstByteSpan section) {
+		std::copy(section.begin(), section.end(), data.begin() + static_cast<ptrdiff_t>(desc.offset));
+	};
+	copy(header.toc, sections.toc);
+	copy(header.pathIndex, sections.pathIndex);
+	copy(header.pathTable, sections.pathTable);
+	copy(header.nodeTable, sections.nodeTable);
+
+	header.payloadHash = crc32_0x04C11DB7(data.data() + sizeof(Header), data.size() - sizeof(Header), 0);
+	std::memcpy(data.data(), &header, sizeof(header));
+
+	const auto tmpFilePath = filePath + ".tmp";
+	if (!saveToFile(tmpFilePath, data.data(), data.size())) {
+		return false;
+	}
+
+	boost::system::error_code ec;
+	boost::filesystem::rename(tmpFilePath, filePath, ec);
+	if (ec) {
+		boost::filesystem::remove(tmpFilePath, ec);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "io_util.hpp"
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+// Sidecar file with the decrypted and inflated TOC of a volume and optional flattened tables derived from it (the path table,
+// the node table and the path index). Sections are aligned, so the file is mapped and used in place on repeat opens. The
+// cache is valid only for the volume it was created from, which is recognized by size, modification time and hash of the
+// encrypted header.
+class TocCache
+	: private boost::noncopyable
+{
+public:
+	struct Key
+	{
+		uint64_t volumeSize;
+		int64_t volumeTime;
+		uint32_t headerHash;
+	};
+
+	// Images of tables are empty if the cache was written without them.
+	struct Sections
+	{
+		ConstByteSpan toc;
+		ConstByteSpan pathIndex;
+		ConstByteSpan pathTable;
+		ConstByteSpan nodeTable;
+	};
+
+	// Returns false if the cache does not exist, was created for a different volume or is damaged.
+	bool open(const std::string& filePath, const Key& key);
+	void close();
+
+	bool isOpen() const { return !m_sections.toc.empty(); }
+
+	const Sections& sections() const { return m_sections; }
+
+	ConstByteSpan toc() const { return m_sections.toc; }
+	ConstByteSpan pathIndex() const { return m_sections.pathIndex; }
+	ConstByteSpan pathTable() const { return m_sections.pathTable; }
+	ConstByteSpan nodeTable() const { return m_sections.nodeTable; }
+
+	// Writes into a temporary file which replaces the old cache only once it is complete.
+	static bool save(const std::string& filePath, const Key& key, const Sections& sections);
+
+private:
+	static const auto MAGIC = UINT64_C(0x314548434354475F); // _GTCTCH1
+	static const auto VERSION = UINT32_C(2);
+	static const auto SECTION_ALIGNMENT = UINT64_C(0x10);
+
+	struct SectionDesc
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct Header
+	{
+		uint64_t magic;
+		uint32_t version;
+		uint32_t headerHash;
+		uint64_t volumeSize;
+		int64_t volumeTime;
+		SectionDesc toc;
+		SectionDesc pathIndex;
+		SectionDesc pathTable;
+		SectionDesc nodeTable;
+		uint32_t payloadHash;
+		uint32_t reserved;
+	};
+
+	InputFile m_file;
+	ByteBuffer m_buffer;
+
+	Sections m_sections;
+};
@@ -41,6 +41,49 @@ inline constexpr T rotateLeft(const T x, unsigned n)
 	return (x << n) | (x >> (bitCount - n));
 }
 
+// Non-owning view over contiguous memory.
+template<typename T>
+class Span
+{
+public:
+	Span()
+		: m_data(nullptr)
+		, m_size(0)
+	{
+	}
+
+	Span(T* data, size_t size)
+		: m_data(data)
+		, m_size(size)
+	{
+	}
+
+	template<typename U, typename = typename std::enable_if_t<std::is_convertible<U*, T*>::value>>
+	Span(const Span<U>& other)
+		: m_data(other.data())
+		, m_size(other.size())
+	{
+	}
+
+	T* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	T* begin() const { return m_data; }
+	T* end() const { return m_data + m_size; }
+
+	T& operator [](size_t index) const { return m_data[index]; }
+
+	Span subspan(size_t offset, size_t count) const { return Span(m_data + offset, count); }
+
+private:
+	T* m_data;
+	size_t m_size;
+};
+
+typedef Span<uint8_t> ByteSpan;
+typedef Span<const uint8_t> ConstByteSpan;
+
 inline int charToInt(int x)
 {
 	if (x >= '0' && x <= '9')
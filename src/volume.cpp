@@ -1,25 +1,41 @@
 #include "volume.hpp"
 #include "compression.hpp"
+#include "crc.hpp"
 #include "debug.hpp"
 
 #include <algorithm>
-#include <iostream>
+#include <atomic>
 #include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <unordered_set>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 
-static inline bool prepareStream(std::ifstream& stream, const std::string& filePath, uint64_t* fileSize = nullptr)
+#ifdef USE_IO_URING
+#	include <cerrno>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+static std::mutex s_errorMutex;
+
+bool VolumeFile::prepareStream(InputFile& file, const std::string& filePath, uint64_t* fileSize) const
 {
-	stream.open(filePath, std::ifstream::in | std::ifstream::binary);
-	if (!stream.is_open()) {
+	if (!file.open(filePath)) {
 		return false;
 	}
 
+	if (m_useMemoryMapping) {
+		// Falls back to positioned reads if the file could not be mapped (e.g. lack of address space).
+		file.map();
+	}
+
 	if (fileSize) {
-		stream.seekg(0, std::ios_base::end);
-		*fileSize = static_cast<uint64_t>(stream.tellg());
-		stream.seekg(0, std::ios_base::beg);
+		*fileSize = file.size();
 	}
 
 	return true;
@@ -31,7 +47,7 @@ bool VolumeFile::load(const std::string& filePath)
 	m_basePath = m_origPath.parent_path();
 	m_baseName = m_origPath.filename();
 
-	if (!prepareStream(m_mainStream, filePath, &m_mainFileSize)) {
+	if (!prepareStream(m_mainFile, filePath, &m_mainFileSize)) {
 		return false;
 	}
 
@@ -39,6 +55,13 @@ bool VolumeFile::load(const std::string& filePath)
 	if (!readDataAt(headerData, 0, getHeaderSize())) {
 		return false;
 	}
+	if (!m_tocCachePath.empty()) {
+		// Encrypted header is hashed, so the cache is checked before any decryption.
+		boost::system::error_code ec;
+		m_tocCacheKey.volumeSize = m_mainFileSize;
+		m_tocCacheKey.volumeTime = static_cast<int64_t>(boost::filesystem::last_write_time(m_origPath, ec));
+		m_tocCacheKey.headerHash = crc32_0x04C11DB7(headerData.data(), headerData.size(), 0);
+	}
 	if (!decryptHeader(headerData.data(), headerData.size())) {
 		return false;
 	}
@@ -48,20 +71,72 @@ bool VolumeFile::load(const std::string& filePath)
 	if (!parseSegment()) {
 		return false;
 	}
+	if (m_tocCache.isOpen()) {
+		// Tables are viewed in the mapped cache, so they are neither decoded nor copied.
+		m_pathTableReady = m_pathTable.load(m_tocCache.pathTable());
+		m_nodeTableReady = m_nodeTable.load(m_tocCache.nodeTable());
+	}
+
+	auto needCacheUpdate = !m_tocCachePath.empty() && (!m_tocCache.isOpen() || !m_pathTableReady || !m_nodeTableReady);
+	if (m_usePathIndex) {
+		if (!m_tocCache.isOpen() || !m_pathIndex.load(m_tocCache.pathIndex())) {
+			if (!buildPathIndex()) {
+				return false;
+			}
+			needCacheUpdate = !m_tocCachePath.empty();
+		}
+	}
+	if (needCacheUpdate && !saveTocCache()) {
+		// Volume is usable without the cache, so only a warning is shown.
+		std::cerr << "Unable to write TOC cache: " << m_tocCachePath << std::endl;
+	}
 
 	return true;
 }
 
-bool VolumeFile::readDataAt(std::ifstream& stream, std::vector<uint8_t>& data, uint64_t offset, uint64_t size)
+bool VolumeFile::loadToc(uint64_t offset, uint64_t size, uint64_t dataSize, uint32_t seed)
 {
-	data.resize(size);
+	if (!m_tocCachePath.empty() && m_tocCache.open(m_tocCachePath, m_tocCacheKey)) {
+		m_data = m_tocCache.toc();
+		return true;
+	}
+
+	ByteBuffer data;
+	if (!readDataAt(data, offset, size)) {
+		return false;
+	}
+	decryptData(data.data(), data.size(), seed);
+	if (!inflateDataIfNeeded(data, dataSize)) {
+		return false;
+	}
 
-	stream.seekg(offset);
-	stream.read(reinterpret_cast<char*>(data.data()), data.size());
+	m_dataBuffer.swap(data);
+	m_data = makeSpan(m_dataBuffer);
 
 	return true;
 }
 
+bool VolumeFile::saveTocCache() const
+{
+	ByteBuffer pathIndexImage;
+	if (!m_pathIndex.empty()) {
+		m_pathIndex.save(pathIndexImage);
+	}
+
+	// Tables are built now if nothing has needed them yet, so later loads find them in the cache.
+	ByteBuffer pathTableImage, nodeTableImage;
+	pathTable().save(pathTableImage);
+	nodeTable().save(nodeTableImage);
+
+	TocCache::Sections sections;
+	sections.toc = m_data;
+	sections.pathIndex = makeSpan(pathIndexImage);
+	sections.pathTable = makeSpan(pathTableImage);
+	sections.nodeTable = makeSpan(nodeTableImage);
+
+	return TocCache::save(m_tocCachePath, m_tocCacheKey, sections);
+}
+
 bool VolumeFile::parseSegment()
 {
 	const auto* p = m_data.data();
@@ -84,6 +159,126 @@ bool VolumeFile::parseSegment()
 	return true;
 }
 
+bool VolumeFile::buildPathIndex()
+{
+	m_pathIndex.clear();
+
+	if (m_entryTreeCount == 0) {
+		return false;
+	}
+
+	const auto& table = pathTable();
+	if (table.empty()) {
+		return false;
+	}
+
+	std::vector<const PathTable::Entry*> fileEntries;
+	std::vector<NodeKey> nodeKeys;
+	for (const auto& entry: table) {
+		if (entry.key.isFile()) {
+			fileEntries.push_back(&entry);
+			nodeKeys.emplace_back(entry.key.linkIndex());
+		}
+	}
+	std::vector<unsigned int> nodeIndices(nodeKeys.size());
+	findNodes(nodeKeys.data(), nodeKeys.size(), nodeIndices.data());
+
+	m_pathIndex.reserve(fileEntries.size());
+	for (auto i = size_t(0); i < fileEntries.size(); ++i) {
+		// Entries without a node can't be unpacked either, they are left out so lookups of them fail as with tree search.
+		if (nodeIndices[i] != NodeBTree::INVALID_INDEX) {
+			const auto normalizedPath = normalizeFilePath(table.path(*fileEntries[i]));
+			m_pathIndex.add(normalizedPath.c_str(), normalizedPath.size(), nodeKeys[i], nodeIndices[i]);
+		}
+	}
+	m_pathIndex.finalize();
+
+	return true;
+}
+
+const PathTable& VolumeFile::pathTable() const
+{
+	// Table is built by the first user, later ones only check the flag.
+	if (!m_pathTableReady.load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lock(m_pathTableMutex);
+		if (!m_pathTableReady.load(std::memory_order_relaxed)) {
+			m_pathTable.build(m_data.data(), nameTreeOffset(), extTreeOffset(), m_entryTreeOffsets, m_threadPool);
+			m_pathTableReady.store(true, std::memory_order_release);
+		}
+	}
+
+	return m_pathTable;
+}
+
+const NodeTable& VolumeFile::nodeTable() const
+{
+	if (!m_nodeTableReady.load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lock(m_nodeTableMutex);
+		if (!m_nodeTableReady.load(std::memory_order_relaxed)) {
+			// Volumes with too sparse node indices are left without the table and their nodes are searched in the tree.
+			const NodeBTree nodeBtree(
+				advancePointer(m_data.data(), nodeTreeOffset()),
+				hasMultipleVolumes()
+			);
+			m_nodeTable.build(nodeBtree, m_threadPool);
+			m_nodeTableReady.store(true, std::memory_order_release);
+		}
+	}
+
+	return m_nodeTable;
+}
+
+unsigned int VolumeFile::findNode(NodeKey& nodeKey) const
+{
+	// Table is not built just for a single node, it is used only if something else has built it already.
+	if (m_nodeTableReady.load(std::memory_order_acquire) && !m_nodeTable.empty()) {
+		return m_nodeTable.find(nodeKey.nodeIndex(), nodeKey);
+	}
+
+	const NodeBTree nodeBtree(
+		advancePointer(m_data.data(), nodeTreeOffset()),
+		hasMultipleVolumes()
+	);
+
+	return nodeBtree.searchByKey(nodeKey);
+}
+
+void VolumeFile::findNodes(NodeKey* nodeKeys, size_t count, unsigned int* indices) const
+{
+	const auto& table = nodeTable();
+	if (!table.empty()) {
+		for (auto i = size_t(0); i < count; ++i) {
+			indices[i] = table.find(nodeKeys[i].nodeIndex(), nodeKeys[i]);
+		}
+		return;
+	}
+
+	// Keys are searched in order of node indices, so lookups of neighbouring nodes share the descent.
+	std::vector<size_t> order(count);
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::sort(order.begin(), order.end(), [nodeKeys](size_t a, size_t b) {
+		return nodeKeys[a].nodeIndex() < nodeKeys[b].nodeIndex();
+	});
+
+	std::vector<NodeKey> sortedKeys;
+	sortedKeys.reserve(count);
+	for (const auto i: order) {
+		sortedKeys.push_back(nodeKeys[i]);
+	}
+	std::vector<unsigned int> sortedIndices(count);
+
+	const NodeBTree nodeBtree(
+		advancePointer(m_data.data(), nodeTreeOffset()),
+		hasMultipleVolumes()
+	);
+	nodeBtree.searchBatch(Span<NodeKey>(sortedKeys.data(), sortedKeys.size()), sortedIndices.data());
+
+	for (auto i = size_t(0); i < count; ++i) {
+		nodeKeys[order[i]] = sortedKeys[i];
+		indices[order[i]] = sortedIndices[i];
+	}
+}
+
 unsigned int VolumeFile::getNodeByPath(const std::string& filePath, NodeKey& nodeKey) const
 {
 	if (m_entryTreeCount == 0) {
@@ -91,6 +286,18 @@ unsigned int VolumeFile::getNodeByPath(const std::string& filePath, NodeKey& nod
 	}
 	
 	const auto normalizedFilePath = normalizeFilePath(filePath);
+	if (!m_pathIndex.empty()) {
+		// Repeated separators are ignored like by the tree search below.
+		std::string indexPath;
+		indexPath.reserve(normalizedFilePath.size());
+		for (const auto c: normalizedFilePath) {
+			if (c != '/' || indexPath.empty() || indexPath.back() != '/') {
+				indexPath += c;
+			}
+		}
+		return m_pathIndex.find(indexPath, nodeKey);
+	}
+
 	std::vector<std::string> parts;
 	boost::algorithm::split(
 		parts,
@@ -145,7 +352,10 @@ unsigned int VolumeFile::getNodeByPath(const std::string& filePath, NodeKey& nod
 		if (entryKey.isDirectory()) {
 			entryTreeIndex = entryKey.linkIndex();
 		} else {
-			nodeIndex = entryKey.linkIndex();
+			// A file has to be the last component, like in the path index.
+			if (i + 1 == parts.size()) {
+				nodeIndex = entryKey.linkIndex();
+			}
 			break;
 		}
 	}
@@ -153,12 +363,8 @@ unsigned int VolumeFile::getNodeByPath(const std::string& filePath, NodeKey& nod
 		return NodeBTree::INVALID_INDEX;
 	}
 	
-	const NodeBTree nodeBtree(
-		advancePointer(m_data.data(), nodeTreeOffset()),
-		hasMultipleVolumes()
-	);
 	nodeKey = NodeKey(nodeIndex);
-	nodeIndex = nodeBtree.searchByKey(nodeKey);
+	nodeIndex = findNode(nodeKey);
 	if (nodeIndex == NodeBTree::INVALID_INDEX) {
 		return NodeBTree::INVALID_INDEX;
 	}
@@ -166,114 +372,831 @@ unsigned int VolumeFile::getNodeByPath(const std::string& filePath, NodeKey& nod
 	return nodeIndex;
 }
 
-class EntryUnpacker
+bool VolumeFile::readNode(const NodeKey& nodeKey, ConstByteSpan& encryptedData, ByteBuffer& data) const
+{
+	const auto volumeIndex = nodeKey.volumeIndex();
+	if (volumeIndex >= m_dataStreams.size()) {
+		return false;
+	}
+	const auto& streamDesc = m_dataStreams[volumeIndex];
+	
+	const auto offset = dataOffset() + static_cast<uint64_t>(nodeKey.sectorIndex()) * streamDesc.sectorSize;
+	
+	// The encrypted node is viewed in place if the stream is mapped, so decryption does the only copy into the working buffer.
+	data = m_bufferPool.acquire(nodeKey.size1());
+	if (!viewDataAt(streamDesc.file, encryptedData, data, offset, nodeKey.size1())) {
+		return false;
+	}
+	if (encryptedData.data() != data.data() && encryptedData.size() >= SEQUENTIAL_HINT_MIN_SIZE) {
+		streamDesc.file.adviseSequential(offset, encryptedData.size());
+	}
+
+	return true;
+}
+
+// Final stage of streamed unpacking, it holds back the leading bytes until it is known whether data is an expanded file.
+class NodeOutput
+	: private boost::noncopyable
 {
 public:
-	explicit EntryUnpacker(VolumeFile& volume, const std::string& outDirectory, const std::string& parentDirectory = std::string())
-		: m_volume(volume)
-		, m_outDirectory(outDirectory)
-		, m_parentDirectory(parentDirectory)
+	explicit NodeOutput(std::ostream& stream)
+		: m_stream(stream)
+		, m_decided(false)
 	{
 	}
-	
-	bool operator ()(const EntryKey& entryKey) const
+
+	bool write(const uint8_t* data, size_t dataSize)
+	{
+		if (!m_decided) {
+			const auto size = std::min(dataSize, FileExpand::SUPER_HEADER_SIZE - m_head.size());
+			m_head.insert(m_head.end(), data, data + size);
+			data += size;
+			dataSize -= size;
+			if (m_head.size() < FileExpand::SUPER_HEADER_SIZE) {
+				return true;
+			}
+
+			if (FileExpand::checkIfExpandedHeader(m_head.data(), m_head.size())) {
+				m_unexpander.reset(new FileUnexpander([this](const uint8_t* data, size_t dataSize) {
+					return writeStream(data, dataSize);
+				}));
+			}
+			m_decided = true;
+
+			if (!writeDecided(m_head.data(), m_head.size())) {
+				return false;
+			}
+		}
+
+		return writeDecided(data, dataSize);
+	}
+
+	bool finish()
+	{
+		if (!m_decided) {
+			m_decided = true;
+			return writeStream(m_head.data(), m_head.size());
+		}
+
+		return m_unexpander ? m_unexpander->finish() : static_cast<bool>(m_stream);
+	}
+
+private:
+	bool writeDecided(const uint8_t* data, size_t dataSize)
+	{
+		return m_unexpander ? m_unexpander->write(data, dataSize) : writeStream(data, dataSize);
+	}
+
+	bool writeStream(const uint8_t* data, size_t dataSize)
 	{
-		const auto entryPath = m_volume.getEntryPath(entryKey, m_parentDirectory);
-		if (entryPath.empty()) {
-			std::cerr << "Cannot determine entry path." << std::endl;
+		m_stream.write(reinterpret_cast<const char*>(data), dataSize);
+		return static_cast<bool>(m_stream);
+	}
+
+	std::ostream& m_stream;
+
+	std::vector<uint8_t> m_head;
+	std::unique_ptr<FileUnexpander> m_unexpander;
+
+	bool m_decided;
+};
+
+bool VolumeFile::unpackNodeStreamed(const NodeKey& nodeKey, const std::string& filePath) const
+{
+	const auto volumeIndex = nodeKey.volumeIndex();
+	if (volumeIndex >= m_dataStreams.size()) {
+		return false;
+	}
+	const auto& streamDesc = m_dataStreams[volumeIndex];
+
+	const auto nodeOffset = dataOffset() + static_cast<uint64_t>(nodeKey.sectorIndex()) * streamDesc.sectorSize;
+	const auto nodeSize = nodeKey.size1();
+	const auto seed = nodeKey.nodeIndex();
+
+	streamDesc.file.adviseSequential(nodeOffset, nodeSize);
+
+	std::ofstream file(filePath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if (!file) {
+		std::lock_guard<std::mutex> lock(s_errorMutex);
+		std::cerr << "Unable to create file: " << filePath << std::endl;
+		return false;
+	}
+
+	NodeOutput output(file);
+	StreamInflater inflater;
+	// Inflated data must add up to the size recorded in the node, like the in-memory path which inflates into a buffer of it.
+	const auto inflatedSizeLimit = nodeKey.size2();
+	auto inflatedSize = UINT64_C(0);
+	const auto sink = [&output, &inflatedSize, inflatedSizeLimit](const uint8_t* data, size_t dataSize) {
+		if (dataSize > inflatedSizeLimit - inflatedSize) {
 			return false;
 		}
-		
-		const auto fullEntryPath = boost::filesystem::path(m_outDirectory) / entryPath;
-		
-		if (entryKey.isDirectory()) {
+		inflatedSize += dataSize;
+
+		return output.write(data, dataSize);
+	};
+
+	// Every chunk is decrypted at its own keystream offset and pushed through inflater (if node is compressed) to the output.
+	auto chunk = m_bufferPool.acquire(static_cast<size_t>(std::min<uint64_t>(nodeSize, m_streamChunkSize)));
+	auto compressed = false;
+	auto result = true;
+	for (auto chunkOffset = UINT64_C(0); chunkOffset < nodeSize && result; chunkOffset += m_streamChunkSize) {
+		const auto chunkSize = static_cast<size_t>(std::min<uint64_t>(nodeSize - chunkOffset, m_streamChunkSize));
+
+		ConstByteSpan encryptedData;
+		if (!viewDataAt(streamDesc.file, encryptedData, chunk, nodeOffset + chunkOffset, chunkSize)) {
+			result = false;
+			break;
+		}
+		if (encryptedData.data() != chunk.data()) {
+			chunk.resize(chunkSize);
+		}
+		decryptData(encryptedData.data(), chunk.data(), chunkSize, seed, chunkOffset);
+
+		const auto* p = chunk.data();
+		auto size = chunkSize;
+
+		if (chunkOffset == 0) {
+			compressed = isDataCompressed(ConstByteSpan(p, size), nodeKey.size2());
+			if (compressed) {
+				p += Z_HEADER_SIZE;
+				size -= Z_HEADER_SIZE;
+				result = inflater.reset();
+			}
+		}
+
+		if (result) {
+			result = compressed ? inflater.write(p, size, sink) : output.write(p, size);
+		}
+	}
+	if (result && compressed && (!inflater.finished() || inflatedSize != inflatedSizeLimit)) {
+		result = false;
+	}
+	if (result) {
+		result = output.finish();
+	}
+	file.close();
+	if (!file) {
+		result = false;
+	}
+	m_bufferPool.release(chunk);
+
+	if (!result) {
+		boost::system::error_code ec;
+		boost::filesystem::remove(filePath, ec);
+
+		std::lock_guard<std::mutex> lock(s_errorMutex);
+		std::cerr << "Error whilst streaming file: " << filePath << std::endl;
+	}
+
+	return result;
+}
+
+bool VolumeFile::buildUnpackPlan(const std::string& outDirectory, UnpackPlan& plan, const EntryFilter* filter) const
+{
+	plan.clear();
+
+	if (m_entryTreeCount == 0) {
+		return false;
+	}
+
+	const auto& table = pathTable();
+	if (table.empty()) {
+		return false;
+	}
+
+	// Selection is decided on the path table alone, so nodes of skipped files are not even looked up.
+	std::vector<bool> selected(table.size());
+	std::vector<NodeKey> nodeKeys;
+	for (auto i = size_t(0); i < table.size(); ++i) {
+		const auto& entry = table[i];
+		if (!entry.key.isDirectory() && (!filter || filter->matches(table, i))) {
+			selected[i] = true;
+			nodeKeys.emplace_back(entry.key.linkIndex());
+		}
+	}
+	std::vector<unsigned int> nodeIndices(nodeKeys.size());
+	findNodes(nodeKeys.data(), nodeKeys.size(), nodeIndices.data());
+
+	// With a filter directories are created only for selected files, otherwise all of them are created (even empty ones).
+	std::vector<bool> createdDirectories(filter ? table.size() : 0);
+
+	// Path table lists a directory before its contents, so directories are created before files are planned into them.
+	std::string entryPath;
+	auto fileIndex = size_t(0);
+	auto missingCount = size_t(0);
+	for (auto i = size_t(0); i < table.size(); ++i) {
+		const auto& entry = table[i];
+		if (entry.key.isDirectory() ? (filter != nullptr) : !selected[i]) {
+			continue;
+		}
+
+		entryPath.assign(table.pathData(entry), entry.pathLength);
+
+		const auto fullEntryPath = boost::filesystem::path(outDirectory) / entryPath;
+
+		if (entry.key.isDirectory()) {
 			std::cout << "DIR:" << entryPath << std::endl;
-			//entryKey.dump();
-			
+
 			boost::filesystem::create_directories(fullEntryPath);
-			
-			const EntryBTree childEntryBtree(
-				advancePointer(m_volume.data().data(), m_volume.entryTreeOffset(entryKey.linkIndex()))
-			);
-			const EntryUnpacker childUnpacker(m_volume, m_outDirectory, entryPath);
-			childEntryBtree.traverse(childUnpacker);
 		} else {
-			std::cout << "FILE:" << entryPath << std::endl;
-			//entryKey.dump();
-			
-			const NodeBTree nodeBtree(
-				advancePointer(m_volume.data().data(), m_volume.nodeTreeOffset()),
-				m_volume.hasMultipleVolumes()
-			);
-			NodeKey nodeKey(entryKey.linkIndex());
-			const auto nodeIndex = nodeBtree.searchByKey(nodeKey);
-			bool unpacked = false;
-			if (nodeIndex != NodeBTree::INVALID_INDEX) {
-				if (m_volume.unpackNode(nodeKey, fullEntryPath.string())) {
-					unpacked = true;
-				}
+			if (filter && entry.parentIndex != PathTable::NO_PARENT && !createdDirectories[entry.parentIndex]) {
+				const auto& parentEntry = table[entry.parentIndex];
+				const auto parentPath = table.path(parentEntry);
+				std::cout << "DIR:" << parentPath << std::endl;
+
+				boost::filesystem::create_directories(boost::filesystem::path(outDirectory) / parentPath);
+				createdDirectories[entry.parentIndex] = true;
 			}
-			if (!unpacked) {
+
+			std::cout << "FILE:" << entryPath << std::endl;
+
+			const auto& nodeKey = nodeKeys[fileIndex];
+			const auto nodeIndex = nodeIndices[fileIndex++];
+			if (nodeIndex == NodeBTree::INVALID_INDEX) {
 				std::cerr << boost::format("Cannot unpack node: %s") % fullEntryPath.string() << std::endl;
-				return false;
+				++missingCount;
+				continue;
 			}
+
+			plan.push_back({ nodeKey, fullEntryPath.string() });
 		}
+	}
 
-		return true;
+	sortUnpackPlan(plan);
+
+	return missingCount == 0;
+}
+
+bool VolumeFile::buildListedUnpackPlan(const std::string& outDirectory, const std::vector<std::string>& filePaths, UnpackPlan& plan) const
+{
+	plan.clear();
+
+	// Every path has to be found before anything is created, so the caller can still fall back to matching the path table.
+	std::vector<NodeKey> nodeKeys(filePaths.size());
+	for (auto i = size_t(0); i < filePaths.size(); ++i) {
+		if (getNodeByPath(filePaths[i], nodeKeys[i]) == NodeBTree::INVALID_INDEX) {
+			return false;
+		}
 	}
 
-private:
-	VolumeFile& m_volume;
-	const std::string& m_outDirectory;
-	std::string m_parentDirectory;
+	std::unordered_set<std::string> createdDirectories;
+	for (auto i = size_t(0); i < filePaths.size(); ++i) {
+		// Path found in the index is spelled as in the volume, so it can't lead outside of the output directory.
+		const auto entryPath = normalizeFilePath(filePaths[i]);
+		const auto parentPath = boost::filesystem::path(entryPath).parent_path().string();
+		if (!parentPath.empty() && createdDirectories.insert(parentPath).second) {
+			std::cout << "DIR:" << parentPath << std::endl;
+
+			boost::filesystem::create_directories(boost::filesystem::path(outDirectory) / parentPath);
+		}
+
+		std::cout << "FILE:" << entryPath << std::endl;
+
+		plan.push_back({ nodeKeys[i], (boost::filesystem::path(outDirectory) / entryPath).string() });
+	}
+
+	sortUnpackPlan(plan);
+
+	return true;
+}
+
+void VolumeFile::sortUnpackPlan(UnpackPlan& plan)
+{
+	// Extract in physical order so reads sweep each volume file sequentially instead of jumping around in name order.
+	std::sort(plan.begin(), plan.end(), [](const UnpackItem& a, const UnpackItem& b) {
+		const auto& x = a.nodeKey;
+		const auto& y = b.nodeKey;
+		if (x.volumeIndex() != y.volumeIndex()) {
+			return x.volumeIndex() < y.volumeIndex();
+		}
+		if (x.sectorIndex() != y.sectorIndex()) {
+			return x.sectorIndex() < y.sectorIndex();
+		}
+		return x.nodeIndex() < y.nodeIndex();
+	});
+}
+
+struct VolumeFile::UnpackBatch
+{
+	enum class State
+	{
+		Failed,
+		Ready,
+		Done,
+	};
+
+	UnpackBatch(const UnpackItem* items, size_t itemCount, bool streamed)
+		: items(items)
+		, itemCount(itemCount)
+		, views(itemCount)
+		, buffers(itemCount)
+		, states(itemCount, State::Failed)
+		, charge(0)
+		, streamed(streamed)
+	{
+	}
+
+	void fail()
+	{
+		std::fill(states.begin(), states.end(), State::Failed);
+	}
+
+	const UnpackItem* items;
+	size_t itemCount;
+
+	std::vector<ConstByteSpan> views;
+	std::vector<ByteBuffer> buffers;
+	std::vector<State> states;
+
+	// Merged reads of neighbouring nodes, views point into it until the batch is decrypted.
+	ByteBuffer readBuffer;
+
+	// Bytes taken from the in-flight budget, they are given back once the batch is written.
+	uint64_t charge;
+
+	bool streamed;
 };
 
-bool VolumeFile::unpackNode(const NodeKey& nodeKey, const std::string& filePath)
+struct VolumeFile::ReadExtent
 {
-	const auto volumeIndex = nodeKey.volumeIndex();
-	if (volumeIndex >= m_dataStreams.size()) {
-		return false;
+	const StreamDesc* streamDesc;
+	uint64_t offset;
+	uint64_t size;
+	uint8_t* data;
+
+	// Range of batch items served by this extent in the list of extent items.
+	size_t firstItem;
+	size_t lastItem;
+
+	bool succeeded;
+};
+
+void VolumeFile::readBatch(UnpackBatch& batch, IoRing* ring, ByteBudget& budget) const
+{
+	if (batch.streamed) {
+		return;
 	}
-	auto& streamDesc = m_dataStreams[volumeIndex];
-	
-	const auto offset = dataOffset() + static_cast<uint64_t>(nodeKey.sectorIndex()) * streamDesc.sectorSize;
-	const auto uncompressedSize = nodeKey.size2();
-	
-	std::vector<uint8_t> data;
-	if (!readDataAt(streamDesc.stream, data, offset, nodeKey.size1())) {
+
+	// Nodes of mapped streams are only viewed, others are merged into extents if the gap between them and the resulting read
+	// are small enough, so neighbouring nodes cost a single request.
+	std::vector<ReadExtent> extents;
+	std::vector<size_t> extentItems;
+	extentItems.reserve(batch.itemCount);
+
+	auto canExtend = false;
+	for (auto i = 0u; i < batch.itemCount; ++i) {
+		const auto& nodeKey = batch.items[i].nodeKey;
+		const auto volumeIndex = nodeKey.volumeIndex();
+		if (volumeIndex >= m_dataStreams.size()) {
+			canExtend = false;
+			continue;
+		}
+		const auto& streamDesc = m_dataStreams[volumeIndex];
+
+		if (streamDesc.file.isMapped()) {
+			if (readNode(nodeKey, batch.views[i], batch.buffers[i])) {
+				batch.states[i] = UnpackBatch::State::Ready;
+			}
+			canExtend = false;
+			continue;
+		}
+
+		const auto offset = dataOffset() + static_cast<uint64_t>(nodeKey.sectorIndex()) * streamDesc.sectorSize;
+		const auto size = nodeKey.size1();
+
+		if (canExtend) {
+			auto& extent = extents.back();
+			const auto extentEnd = extent.offset + extent.size;
+			if (extent.streamDesc == &streamDesc && offset >= extentEnd && (offset - extentEnd) <= m_pipelineConfig.maxReadGap && (offset + size - extent.offset) <= m_pipelineConfig.maxReadSize) {
+				extent.size = offset + size - extent.offset;
+				extent.lastItem = extentItems.size();
+				extentItems.push_back(i);
+				continue;
+			}
+		}
+
+		extents.push_back({ &streamDesc, offset, size, nullptr, extentItems.size(), extentItems.size(), false });
+		extentItems.push_back(i);
+		canExtend = true;
+	}
+
+	if (extents.empty()) {
+		return;
+	}
+
+	// Extent of a single node is read straight into its buffer, merged ones go to the shared buffer and are sliced from there.
+	auto sharedSize = UINT64_C(0);
+	for (const auto& extent: extents) {
+		if (extent.firstItem != extent.lastItem) {
+			sharedSize += extent.size;
+		}
+	}
+	batch.readBuffer = m_bufferPool.acquire(static_cast<size_t>(sharedSize));
+	budget.charge(sharedSize);
+	batch.charge += sharedSize;
+
+	auto sharedOffset = size_t(0);
+	for (auto& extent: extents) {
+		if (extent.firstItem != extent.lastItem) {
+			extent.data = batch.readBuffer.data() + sharedOffset;
+			sharedOffset += static_cast<size_t>(extent.size);
+		} else {
+			auto& data = batch.buffers[extentItems[extent.firstItem]];
+			data = m_bufferPool.acquire(static_cast<size_t>(extent.size));
+			extent.data = data.data();
+		}
+	}
+
+	if (!ring || !readExtentsWithRing(extents.data(), extents.size(), *ring)) {
+		for (auto& extent: extents) {
+			extent.succeeded = extent.streamDesc->file.readAt(extent.offset, extent.data, static_cast<size_t>(extent.size));
+		}
+	}
+
+	for (const auto& extent: extents) {
+		if (!extent.succeeded) {
+			continue;
+		}
+
+		for (auto k = extent.firstItem; k <= extent.lastItem; ++k) {
+			const auto i = extentItems[k];
+			const auto& nodeKey = batch.items[i].nodeKey;
+			const auto offset = dataOffset() + static_cast<uint64_t>(nodeKey.sectorIndex()) * extent.streamDesc->sectorSize;
+
+			batch.views[i] = ConstByteSpan(extent.data + (offset - extent.offset), nodeKey.size1());
+			if (extent.firstItem != extent.lastItem) {
+				batch.buffers[i] = m_bufferPool.acquire(nodeKey.size1());
+			}
+			batch.states[i] = UnpackBatch::State::Ready;
+		}
+	}
+}
+
+bool VolumeFile::readExtentsWithRing(ReadExtent* extents, size_t extentCount, IoRing& ring) const
+{
+#ifdef USE_IO_URING
+	std::vector<IoRing::Request> requests(extentCount);
+	for (auto i = 0u; i < extentCount; ++i) {
+		const auto& extent = extents[i];
+		auto& request = requests[i];
+		request.fd = extent.streamDesc->file.descriptor();
+		request.offset = extent.offset;
+		request.data = extent.data;
+		request.size = static_cast<size_t>(extent.size);
+	}
+
+	if (!ring.read(requests.data(), requests.size())) {
 		return false;
 	}
 
-	decryptData(data.data(), data.size(), nodeKey.nodeIndex());
-	inflateDataIfNeeded(data, uncompressedSize);
-	
-	if (FileExpand::checkIfExpanded(data)) {
-		std::vector<uint8_t> unexpandedData;
-		if (FileExpand::unexpand(data, unexpandedData)) {
-			saveToFile(filePath, unexpandedData.data(), unexpandedData.size());
+	for (auto i = 0u; i < extentCount; ++i) {
+		extents[i].succeeded = (requests[i].result == static_cast<int64_t>(requests[i].size));
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void VolumeFile::decryptBatch(UnpackBatch& batch) const
+{
+	std::vector<Keyset::CryptJob> cryptJobs;
+	cryptJobs.reserve(batch.itemCount);
+
+	for (auto i = 0u; i < batch.itemCount; ++i) {
+		if (batch.states[i] != UnpackBatch::State::Ready) {
+			continue;
+		}
+
+		const auto& nodeKey = batch.items[i].nodeKey;
+		const auto& view = batch.views[i];
+		if (view.size() > BATCH_DECRYPT_MAX_SIZE) {
+			decryptData(view.data(), batch.buffers[i].data(), view.size(), nodeKey.nodeIndex());
 		} else {
-			std::cerr << "Error whilst unexpanding file: " << filePath << std::endl;
+			cryptJobs.push_back({ view.data(), batch.buffers[i].data(), view.size(), nodeKey.nodeIndex() });
 		}
-	} else {
-		saveToFile(filePath, data.data(), data.size());
 	}
-	
+
+	getKeyset().cryptBatch(cryptJobs.data(), cryptJobs.size());
+
+	m_bufferPool.release(batch.readBuffer);
+}
+
+void VolumeFile::inflateBatch(UnpackBatch& batch, ByteBudget& budget) const
+{
+	if (batch.streamed) {
+		const auto& item = batch.items[0];
+		batch.states[0] = unpackNodeStreamed(item.nodeKey, item.filePath) ? UnpackBatch::State::Done : UnpackBatch::State::Failed;
+		return;
+	}
+
+	for (auto i = 0u; i < batch.itemCount; ++i) {
+		if (batch.states[i] != UnpackBatch::State::Ready) {
+			continue;
+		}
+
+		const auto& item = batch.items[i];
+		auto& data = batch.buffers[i];
+		const auto storedSize = data.size();
+
+		if (isDataCompressed(makeSpan(data), item.nodeKey.size2()) && !inflateDataIfNeeded(data, item.nodeKey.size2())) {
+			batch.states[i] = UnpackBatch::State::Failed;
+
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << "Error whilst inflating file: " << item.filePath << std::endl;
+		} else if (FileExpand::checkIfExpanded(makeSpan(data))) {
+			// Other inflater threads keep the cores busy with small files, segments of big ones are inflated on the pool.
+			const auto unexpandedCapacity = FileExpand::getUnexpandedSize(makeSpan(data));
+			auto* pool = (unexpandedCapacity >= PARALLEL_UNEXPAND_MIN_SIZE) ? m_threadPool : nullptr;
+			auto unexpandedData = m_bufferPool.acquire(unexpandedCapacity);
+			auto unexpandedSize = size_t(0);
+			const auto unexpanded = FileExpand::unexpand(makeSpan(data), makeSpan(unexpandedData), &unexpandedSize, pool);
+			unexpandedData.resize(unexpandedSize);
+			data.swap(unexpandedData);
+			m_bufferPool.release(unexpandedData);
+			if (!unexpanded) {
+				batch.states[i] = UnpackBatch::State::Failed;
+
+				std::lock_guard<std::mutex> lock(s_errorMutex);
+				std::cerr << "Error whilst unexpanding file: " << item.filePath << std::endl;
+			}
+		}
+
+		if (data.size() > storedSize) {
+			const auto growth = static_cast<uint64_t>(data.size() - storedSize);
+			budget.charge(growth);
+			batch.charge += growth;
+		}
+	}
+}
+
+size_t VolumeFile::writeBatch(UnpackBatch& batch, IoRing* ring) const
+{
+	if (!ring || !writeBatchWithRing(batch, *ring)) {
+		for (auto i = 0u; i < batch.itemCount; ++i) {
+			if (batch.states[i] == UnpackBatch::State::Ready) {
+				const auto& data = batch.buffers[i];
+				batch.states[i] = saveToFile(batch.items[i].filePath, data.data(), data.size()) ? UnpackBatch::State::Done : UnpackBatch::State::Failed;
+			}
+		}
+	}
+
+	auto failedCount = size_t(0);
+	for (auto i = 0u; i < batch.itemCount; ++i) {
+		m_bufferPool.release(batch.buffers[i]);
+
+		if (batch.states[i] == UnpackBatch::State::Failed) {
+			++failedCount;
+
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << boost::format("Cannot unpack node: %s") % batch.items[i].filePath << std::endl;
+		}
+	}
+
+	return failedCount;
+}
+
+bool VolumeFile::writeBatchWithRing(UnpackBatch& batch, IoRing& ring) const
+{
+#ifdef USE_IO_URING
+	std::vector<IoRing::Request> requests;
+	std::vector<size_t> requestItems;
+	requests.reserve(batch.itemCount);
+	requestItems.reserve(batch.itemCount);
+
+	for (auto i = 0u; i < batch.itemCount; ++i) {
+		if (batch.states[i] != UnpackBatch::State::Ready) {
+			continue;
+		}
+
+		IoRing::Request request;
+		request.path = batch.items[i].filePath.c_str();
+		request.data = batch.buffers[i].data();
+		request.size = batch.buffers[i].size();
+		requests.push_back(request);
+		requestItems.push_back(i);
+	}
+
+	if (requests.empty()) {
+		return true;
+	}
+
+	// All files of the batch are opened, written and closed with one submission per step.
+	const auto closeOpened = [&requests]() {
+		for (const auto& request: requests) {
+			if (request.fd >= 0) {
+				::close(request.fd);
+			}
+		}
+	};
+
+	const auto ringOpened = ring.open(requests.data(), requests.size(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	for (auto& request: requests) {
+		request.fd = (request.result >= 0) ? static_cast<int>(request.result) : -1;
+	}
+	if (!ringOpened) {
+		closeOpened();
+		return false;
+	}
+
+	std::vector<IoRing::Request> writeRequests;
+	std::vector<size_t> writeRequestIndices;
+	writeRequests.reserve(requests.size());
+	writeRequestIndices.reserve(requests.size());
+	for (auto i = 0u; i < requests.size(); ++i) {
+		if (requests[i].fd >= 0) {
+			writeRequests.push_back(requests[i]);
+			writeRequestIndices.push_back(i);
+		}
+	}
+	if (!ring.write(writeRequests.data(), writeRequests.size())) {
+		closeOpened();
+		return false;
+	}
+
+	auto closeRequests = writeRequests;
+	if (!ring.close(closeRequests.data(), closeRequests.size())) {
+		for (auto& request: closeRequests) {
+			if (request.result == -ECANCELED) {
+				request.result = ::close(request.fd);
+			}
+		}
+	}
+
+	for (auto i = 0u; i < requests.size(); ++i) {
+		batch.states[requestItems[i]] = UnpackBatch::State::Failed;
+	}
+	for (auto i = 0u; i < writeRequests.size(); ++i) {
+		const auto& request = writeRequests[i];
+		if (request.result == static_cast<int64_t>(request.size) && closeRequests[i].result == 0) {
+			batch.states[requestItems[writeRequestIndices[i]]] = UnpackBatch::State::Done;
+		}
+	}
+
 	return true;
+#else
+	return false;
+#endif
+}
+
+bool VolumeFile::unpackPlanPipelined(const UnpackPlan& plan)
+{
+	for (const auto& streamDesc: m_dataStreams) {
+		streamDesc.file.adviseSequential(0, streamDesc.file.size());
+	}
+
+	// Small neighbouring nodes travel together so they are decrypted in a single keyset batch, nodes above the stream chunk
+	// size go alone and are unpacked chunk by chunk by the inflater which does their I/O too.
+	struct BatchRange
+	{
+		size_t first;
+		size_t count;
+		bool streamed;
+	};
+	std::vector<BatchRange> ranges;
+	for (auto i = size_t(0); i < plan.size();) {
+		const auto nodeSize = plan[i].nodeKey.size1();
+		if (nodeSize > BATCH_DECRYPT_MAX_SIZE) {
+			ranges.push_back({ i, 1, nodeSize > m_streamChunkSize });
+			++i;
+			continue;
+		}
+
+		auto last = i + 1;
+		while (last < plan.size() && (last - i) < UNPACK_BATCH_SIZE && plan[last].nodeKey.size1() <= BATCH_DECRYPT_MAX_SIZE) {
+			++last;
+		}
+		ranges.push_back({ i, last - i, false });
+		i = last;
+	}
+
+	const auto defaultCount = m_threadPool ? m_threadPool->threadCount() : 1u;
+	const auto stageCount = [defaultCount](unsigned int count) {
+		return (count != 0) ? count : defaultCount;
+	};
+
+	// CPU stages share the jobs count by default, inflation is the heavier one so it takes the bigger part.
+	const auto decrypterCount = (m_pipelineConfig.decrypterCount != 0) ? m_pipelineConfig.decrypterCount : std::max(defaultCount / 4, 1u);
+	const auto inflaterCount = (m_pipelineConfig.inflaterCount != 0) ? m_pipelineConfig.inflaterCount : std::max(defaultCount - std::min(decrypterCount, defaultCount), 1u);
+
+	typedef std::unique_ptr<UnpackBatch> BatchPtr;
+	BoundedQueue<BatchPtr> decryptQueue(PIPELINE_QUEUE_CAPACITY);
+	BoundedQueue<BatchPtr> inflateQueue(PIPELINE_QUEUE_CAPACITY);
+	BoundedQueue<BatchPtr> writeQueue(PIPELINE_QUEUE_CAPACITY);
+	ByteBudget budget(m_pipelineConfig.maxInFlightSize);
+
+	// Failure of a stage is recorded in the batch, so it still reaches the writer which reports it and releases its budget.
+	const auto process = [](UnpackBatch& batch, const std::function<void()>& func) {
+		try {
+			func();
+		}
+		catch (const std::exception& e) {
+			batch.fail();
+
+			std::lock_guard<std::mutex> lock(s_errorMutex);
+			std::cerr << "Unhandled error occurred:" << std::endl << e.what() << std::endl;
+		}
+	};
+
+	std::atomic<size_t> nextRangeIndex(0);
+	PipelineStage readers(stageCount(m_pipelineConfig.readerCount), [&]() {
+		IoRing ring;
+		auto* readRing = (m_useIoRing && ring.init()) ? &ring : nullptr;
+
+		for (;;) {
+			const auto index = nextRangeIndex++;
+			if (index >= ranges.size()) {
+				break;
+			}
+			const auto& range = ranges[index];
+
+			BatchPtr batch(new UnpackBatch(&plan[range.first], range.count, range.streamed));
+			if (range.streamed) {
+				batch->charge = m_streamChunkSize;
+			} else {
+				for (auto i = 0u; i < batch->itemCount; ++i) {
+					batch->charge += batch->items[i].nodeKey.size1();
+				}
+			}
+			budget.acquire(batch->charge);
+
+			process(*batch, [&]() { readBatch(*batch, readRing, budget); });
+			decryptQueue.push(std::move(batch));
+		}
+	}, [&]() { decryptQueue.close(); });
+
+	PipelineStage decrypters(decrypterCount, [&]() {
+		BatchPtr batch;
+		while (decryptQueue.pop(batch)) {
+			process(*batch, [&]() { decryptBatch(*batch); });
+			inflateQueue.push(std::move(batch));
+		}
+	}, [&]() { inflateQueue.close(); });
+
+	PipelineStage inflaters(inflaterCount, [&]() {
+		BatchPtr batch;
+		while (inflateQueue.pop(batch)) {
+			process(*batch, [&]() { inflateBatch(*batch, budget); });
+			writeQueue.push(std::move(batch));
+		}
+	}, [&]() { writeQueue.close(); });
+
+	std::atomic<size_t> failedCount(0);
+	PipelineStage writers(stageCount(m_pipelineConfig.writerCount), [&]() {
+		IoRing ring;
+		auto* writeRing = (m_useIoRing && ring.init()) ? &ring : nullptr;
+
+		BatchPtr batch;
+		while (writeQueue.pop(batch)) {
+			process(*batch, [&]() { failedCount += writeBatch(*batch, writeRing); });
+			budget.release(batch->charge);
+			batch.reset();
+		}
+	}, nullptr);
+
+	readers.join();
+	decrypters.join();
+	inflaters.join();
+	writers.join();
+
+	return failedCount == 0;
 }
 
 bool VolumeFile::unpackAll(const std::string& outDirectory)
 {
-	if (m_entryTreeCount == 0) {
+	// Files which could not be planned are reported already, the rest is unpacked before failing like in the pipeline.
+	UnpackPlan plan;
+	const auto planned = buildUnpackPlan(outDirectory, plan);
+	if (plan.empty() && !planned) {
 		return false;
 	}
-	
-	const EntryBTree rootEntryBtree(
-		advancePointer(m_data.data(), entryTreeOffset(0))
-	);
-	const EntryUnpacker unpacker(*this, outDirectory);
-	rootEntryBtree.traverse(unpacker);
 
-	return true;
+	return unpackPlanPipelined(plan) && planned;
+}
+
+bool VolumeFile::unpackSelected(const std::string& outDirectory, EntryFilter& filter)
+{
+	if (pathTable().empty()) {
+		return false;
+	}
+	if (!filter.prepare(pathTable())) {
+		std::cerr << "Cannot find subtree root directory." << std::endl;
+		return false;
+	}
+
+	// Listed files are looked up in the path index if there is one, paths missing in it are left to the case-insensitive match.
+	UnpackPlan plan;
+	const auto listed = !m_pathIndex.empty() && filter.selectsListedPathsOnly() && buildListedUnpackPlan(outDirectory, filter.listedPaths(), plan);
+	const auto planned = listed || buildUnpackPlan(outDirectory, plan, &filter);
+	if (plan.empty() && !planned) {
+		return false;
+	}
+
+	std::cout << boost::format("Selected %u files.") % plan.size() << std::endl;
+
+	return unpackPlanPipelined(plan) && planned;
 }
 
 bool VolumeFile::decryptHeader(uint8_t* header, uint64_t headerSize) const
@@ -298,71 +1221,95 @@ bool VolumeFile::decryptHeader(uint8_t* header, uint64_t headerSize) const
 
 bool VolumeFile::decryptData(uint8_t* data, uint64_t dataSize, uint32_t seed) const
 {
-	if (!data) {
+	return decryptData(data, data, dataSize, seed);
+}
+
+bool VolumeFile::decryptData(const uint8_t* in, uint8_t* out, uint64_t dataSize, uint32_t seed, uint64_t keyOffset) const
+{
+	if (!in || !out) {
 		return false;
 	}
 
-	if (dataSize > 0) {
-		const auto& keyset = getKeyset();
-		keyset.cryptBytes(data, data + dataSize, data, seed);
+	if (dataSize == 0) {
+		return true;
 	}
 
-	return true;
-}
+	const auto& keyset = getKeyset();
 
-bool VolumeFile::inflateDataIfNeeded(std::vector<uint8_t>& in, uint64_t outSize) const {
-	if (outSize > UINT32_MAX)
-		return false;
+	if (!m_threadPool || dataSize < PARALLEL_DECRYPT_MIN_SIZE) {
+		keyset.cryptBytesAt(keyOffset, in, in + dataSize, out, seed);
+		return true;
+	}
 
-	const auto* p = in.data();
+	// Keystream can be started at any offset, so big buffers are split into chunks decrypted independently.
+	const uint64_t maxChunkSize = PARALLEL_DECRYPT_CHUNK_SIZE;
+	TaskGroup tasks(m_threadPool);
+	for (auto offset = UINT64_C(0); offset < dataSize; offset += maxChunkSize) {
+		const auto chunkSize = std::min(dataSize - offset, maxChunkSize);
+		tasks.run([&keyset, in, out, offset, chunkSize, seed, keyOffset]() {
+			keyset.cryptBytesAt(keyOffset + offset, in + offset, in + offset + chunkSize, out + offset, seed);
+		});
+	}
+	tasks.wait();
 
-	// XXX: inflated data use little-endian always.
-	const auto magic = readNext<uint32_t>(p);
-	const auto sizeComplement = readNext<uint32_t>(p);
+	return true;
+}
 
-	if (magic != Z_MAGIC || (static_cast<uint32_t>(outSize) + sizeComplement) != 0) { // not compressed?
+bool VolumeFile::readNodeData(const NodeKey& nodeKey, uint64_t offset, uint64_t size, std::vector<uint8_t>& data) const
+{
+	const auto volumeIndex = nodeKey.volumeIndex();
+	if (volumeIndex >= m_dataStreams.size()) {
+		return false;
+	}
+	if (offset > nodeKey.size1() || size > nodeKey.size1() - offset) {
 		return false;
 	}
+	const auto& streamDesc = m_dataStreams[volumeIndex];
 
-	const auto headerSize = sizeof(magic) + sizeof(sizeComplement);
-	if (in.size() < headerSize) {
+	const auto nodeOffset = dataOffset() + static_cast<uint64_t>(nodeKey.sectorIndex()) * streamDesc.sectorSize;
+
+	ConstByteSpan encryptedData;
+	if (!viewDataAt(streamDesc.file, encryptedData, data, nodeOffset + offset, size)) {
 		return false;
 	}
+	if (encryptedData.data() != data.data()) {
+		data.resize(encryptedData.size());
+	}
 
-	std::vector<uint8_t> out;
-	FileExpand::inflate(out, p, in.size() - headerSize);
-	in.swap(out);
+	getKeyset().cryptBytesAt(offset, encryptedData.begin(), encryptedData.end(), data.data(), nodeKey.nodeIndex());
 
 	return true;
 }
 
-std::string VolumeFile::getEntryPath(const EntryKey& entryKey, const std::string& prefix) const
+bool VolumeFile::isDataCompressed(ConstByteSpan data, uint64_t outSize) const
 {
-	std::string path(prefix);
-
-	StringBTree nameBtree(
-		advancePointer(m_data.data(), nameTreeOffset())
-	);
-	StringKey nameKey;
-	if (nameBtree.searchByIndex(entryKey.nameIndex(), nameKey)) {
-		path.append(nameKey.value(), nameKey.value() + nameKey.length());
+	if (outSize > UINT32_MAX || data.size() < Z_HEADER_SIZE) {
+		return false;
 	}
 
-	if (entryKey.isFile()) {
-		StringBTree extBtree(
-			advancePointer(m_data.data(), extTreeOffset())
-		);
-		StringKey extKey;
-		if (extBtree.searchByIndex(entryKey.extIndex(), extKey)) {
-			if (extKey.length() > 0) {
-				path.append(extKey.value(), extKey.value() + extKey.length());
-			}
-		}
-	} else if (entryKey.isDirectory()) {
-		path += '/';
+	// XXX: inflated data use little-endian always.
+	const auto magic = read<uint32_t>(data.data());
+	const auto sizeComplement = read<uint32_t>(data.data() + sizeof(magic));
+
+	return magic == Z_MAGIC && (static_cast<uint32_t>(outSize) + sizeComplement) == 0;
+}
+
+bool VolumeFile::inflateDataIfNeeded(ByteBuffer& in, uint64_t outSize) const {
+	if (!isDataCompressed(makeSpan(in), outSize)) { // not compressed?
+		return false;
 	}
 
-	return path;
+	const auto* p = in.data() + Z_HEADER_SIZE;
+
+	// Output size is known from the node, so data is inflated straight into a buffer of final size.
+	auto out = m_bufferPool.acquire(static_cast<size_t>(outSize));
+	auto producedSize = size_t(0);
+	const auto result = FileExpand::inflate(out.data(), out.size(), p, in.size() - Z_HEADER_SIZE, &producedSize);
+	out.resize(producedSize);
+	in.swap(out);
+	m_bufferPool.release(out);
+
+	return result;
 }
 
 const Keyset& GT5VolumeFile::getKeyset() const
@@ -395,23 +1342,17 @@ bool GT5VolumeFile::parseHeader(const uint8_t* header, uint64_t headerSize)
 	VOLUME_READN_NEXT_SELF(p, char, titleId, sizeof(titleId));
 	m_titleId = titleId;
 
-	std::vector<uint8_t> data;
-	if (!readDataAt(data, headerSizeAligned, zDataSize)) {
-		return false;
-	}
-	decryptData(data.data(), data.size(), seed);
-	if (!inflateDataIfNeeded(data, dataSize)) {
+	if (!loadToc(headerSizeAligned, zDataSize, dataSize, seed)) {
 		return false;
 	}
 
 	m_dataOffset = alignUp(headerSizeAligned + zDataSize, SEGMENT_SIZE);
-	m_data.swap(data);
 
 	m_dataStreams.emplace_back();
 	auto& streamDesc = m_dataStreams.back();
 	{
 		streamDesc.filePath = m_origPath.string();
-		if (!prepareStream(streamDesc.stream, streamDesc.filePath, &streamDesc.fileSize)) {
+		if (!prepareStream(streamDesc.file, streamDesc.filePath, &streamDesc.fileSize)) {
 			return false;
 		}
 		std::cout << boost::format("Data file size: %1%") % streamDesc.fileSize << std::endl;
@@ -476,24 +1417,18 @@ bool GT7VolumeFile::parseHeader(const uint8_t* header, uint64_t headerSize)
 		volumeInfo.fileSize = (volumeInfo.fileSize >> 32) | ((volumeInfo.fileSize & 0xFFFFFFFF) << 32);
 	}
 
-	std::vector<uint8_t> data;
-	if (!readDataAt(data, headerSizeAligned, zDataSize)) {
-		return false;
-	}
-	decryptData(data.data(), data.size(), seed);
-	if (!inflateDataIfNeeded(data, dataSize)) {
+	if (!loadToc(headerSizeAligned, zDataSize, dataSize, seed)) {
 		return false;
 	}
 
 	m_dataOffset = 0;
-	m_data.swap(data);
 
 	for (auto& volumeInfo: m_volumes) {
 		m_dataStreams.emplace_back();
 		auto& streamDesc = m_dataStreams.back();
 		{
 			streamDesc.filePath = (m_basePath / volumeInfo.fileName).string();
-			if (!prepareStream(streamDesc.stream, streamDesc.filePath, &streamDesc.fileSize)) {
+			if (!prepareStream(streamDesc.file, streamDesc.filePath, &streamDesc.fileSize)) {
 				return false;
 			}
 			if (!parseExtendedHeader(streamDesc)) {
@@ -509,7 +1444,7 @@ bool GT7VolumeFile::parseExtendedHeader(StreamDesc& streamDesc)
 {
 	streamDesc.extHeader.clear();
 
-	if (!readDataAt(streamDesc.stream, streamDesc.extHeader, 0, sizeof(ExtHeader))) {
+	if (!readDataAt(streamDesc.file, streamDesc.extHeader, 0, sizeof(ExtHeader))) {
 		return false;
 	}
 
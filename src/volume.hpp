@@ -1,9 +1,19 @@
 #pragma once
 
 #include "btree.hpp"
+#include "buffer_pool.hpp"
 #include "crypto.hpp"
-
-#include <fstream>
+#include "entry_filter.hpp"
+#include "io_ring.hpp"
+#include "node_table.hpp"
+#include "path_index.hpp"
+#include "path_table.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+#include "toc_cache.hpp"
+
+#include <atomic>
+#include <mutex>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -33,8 +43,51 @@ class VolumeFile
 public:
 	static const auto SEGMENT_SIZE = UINT64_C(0x800);
 
+	static const auto DEFAULT_STREAM_CHUNK_SIZE = size_t(0x800000);
+
+	static const auto DEFAULT_MAX_IN_FLIGHT_SIZE = UINT64_C(0x10000000);
+
+	static const auto DEFAULT_MAX_READ_GAP = UINT64_C(0x10000);
+	static const auto DEFAULT_MAX_READ_SIZE = UINT64_C(0x200000);
+
+	// Thread counts of extraction stages, zero means that count is derived from size of the thread pool. Decrypters and
+	// inflaters split the pool size between them by default.
+	struct PipelineConfig
+	{
+		PipelineConfig()
+			: readerCount(1)
+			, decrypterCount(0)
+			, inflaterCount(0)
+			, writerCount(1)
+			, maxInFlightSize(DEFAULT_MAX_IN_FLIGHT_SIZE)
+			, maxReadGap(DEFAULT_MAX_READ_GAP)
+			, maxReadSize(DEFAULT_MAX_READ_SIZE)
+		{
+		}
+
+		unsigned int readerCount;
+		unsigned int decrypterCount;
+		unsigned int inflaterCount;
+		unsigned int writerCount;
+
+		// Bytes of node data held by all stages together.
+		uint64_t maxInFlightSize;
+
+		// Nodes of a batch are read together if they are separated by no more than the gap and the merged read does not
+		// exceed the size, zero size disables merging.
+		uint64_t maxReadGap;
+		uint64_t maxReadSize;
+	};
+
 	VolumeFile(bool swapEndian)
-		: m_swapEndian(swapEndian)
+		: m_pathTableReady(false)
+		, m_nodeTableReady(false)
+		, m_threadPool(nullptr)
+		, m_streamChunkSize(DEFAULT_STREAM_CHUNK_SIZE)
+		, m_useMemoryMapping(true)
+		, m_useIoRing(true)
+		, m_usePathIndex(false)
+		, m_swapEndian(swapEndian)
 	{
 		reset();
 	}
@@ -43,10 +96,81 @@ public:
 
 	bool load(const std::string& filePath);
 
-	bool unpackNode(const NodeKey& nodeKey, const std::string& filePath);
+	struct UnpackItem
+	{
+		NodeKey nodeKey;
+		std::string filePath;
+	};
+
+	typedef std::vector<UnpackItem> UnpackPlan;
+
+	// Reads and decrypts a range of node's stored data without decrypting the bytes before it, offset is relative to the node.
+	bool readNodeData(const NodeKey& nodeKey, uint64_t offset, uint64_t size, std::vector<uint8_t>& data) const;
 	bool unpackAll(const std::string& outDirectory);
+	// Unpacks only files selected by the filter, the filter gets prepared against the path table of the volume.
+	bool unpackSelected(const std::string& outDirectory, EntryFilter& filter);
+
+	// Collects file nodes of the volume sorted by their physical location and creates output directories. If a prepared filter
+	// is given then only selected files are collected and only directories which contain them are created. Files whose nodes
+	// are missing are reported and left out of the plan, which then fails.
+	bool buildUnpackPlan(const std::string& outDirectory, UnpackPlan& plan, const EntryFilter* filter = nullptr) const;
+	// Same as buildUnpackPlan() for files given by their paths, which are resolved by getNodeByPath(). Returns false without
+	// creating anything if some path is not found.
+	bool buildListedUnpackPlan(const std::string& outDirectory, const std::vector<std::string>& filePaths, UnpackPlan& plan) const;
+
+	// Unpacks nodes with separate reader, decrypter, inflater and writer threads connected by bounded queues, so disk and CPU
+	// work overlap while data held in between is capped by the in-flight budget.
+	bool unpackPlanPipelined(const UnpackPlan& plan);
+
+	// If set then file nodes are unpacked concurrently on the pool, the pool must outlive any unpacking.
+	void setThreadPool(ThreadPool* pool) { m_threadPool = pool; }
+	ThreadPool* threadPool() const { return m_threadPool; }
+
+	// Nodes bigger than the chunk size are read, decrypted, inflated and written chunk by chunk, so memory used by a node is bounded.
+	void setStreamChunkSize(size_t chunkSize) { m_streamChunkSize = (chunkSize > MIN_STREAM_CHUNK_SIZE) ? chunkSize : MIN_STREAM_CHUNK_SIZE; }
+	size_t streamChunkSize() const { return m_streamChunkSize; }
+
+	void setPipelineConfig(const PipelineConfig& config) { m_pipelineConfig = config; }
+	const PipelineConfig& pipelineConfig() const { return m_pipelineConfig; }
+
+	// If enabled then data streams are mapped into memory and nodes are decrypted straight from the mapping, must be set before loading.
+	void setUseMemoryMapping(bool useMemoryMapping) { m_useMemoryMapping = useMemoryMapping; }
+	bool useMemoryMapping() const { return m_useMemoryMapping; }
+
+	// If enabled then a hash index of all file paths is built on load, so getNodeByPath() does not search trees and files
+	// listed for unpackSelected() are not matched against the whole path table. Must be set before loading.
+	void setUsePathIndex(bool usePathIndex) { m_usePathIndex = usePathIndex; }
+	bool usePathIndex() const { return m_usePathIndex; }
+
+	bool buildPathIndex();
+
+	// Decodes all entry trees into the path table on first use (unless it is taken from the TOC cache), it is used for listing
+	// and planning of extraction. The table is empty if the trees are malformed.
+	const PathTable& pathTable() const;
+
+	// Decodes the node tree into the node table on first use (unless it is taken from the TOC cache), then nodes are not
+	// searched in the tree. The table is empty if node indices are too sparse for it.
+	const NodeTable& nodeTable() const;
+
+	// Fills the key by its node index and returns index of the node in the node tree or NodeBTree::INVALID_INDEX if there
+	// is no such node.
+	unsigned int findNode(NodeKey& nodeKey) const;
+	// Same as findNode() for many keys, it builds the node table and without one the tree is searched once for all of them.
+	void findNodes(NodeKey* nodeKeys, size_t count, unsigned int* indices) const;
+
+	// If set then the decrypted TOC, the path and node tables (and the path index if it is used) are kept in a sidecar file and
+	// taken from there on later loads of the same volume. Empty path disables the cache, it must be set before loading.
+	void setTocCachePath(const std::string& path) { m_tocCachePath = path; }
+	const std::string& tocCachePath() const { return m_tocCachePath; }
+
+	// Returns index of the node in the node tree or NodeBTree::INVALID_INDEX if there is no such file. The path has to end
+	// with the file, so "dir/file.dat/x" is not found whether the path index or the trees are searched.
+	unsigned int getNodeByPath(const std::string& filePath, NodeKey& nodeKey) const;
 
-	std::string getEntryPath(const EntryKey& entryKey, const std::string& prefix) const;
+	// If enabled then pipeline stages batch reads of unmapped streams and writes of output files through io_uring, stages
+	// fall back to regular I/O if it is not available.
+	void setUseIoRing(bool useIoRing) { m_useIoRing = useIoRing; }
+	bool useIoRing() const { return m_useIoRing; }
 
 	const auto& data() const { return m_data; }
 
@@ -64,10 +188,29 @@ protected:
 	static const auto HEADER_MAGIC = UINT32_C(0x5B745162);
 	static const auto SEGMENT_MAGIC = UINT32_C(0x5B74516E);
 	static const auto Z_MAGIC = UINT32_C(0xFFF7EEC5);
+	static const auto Z_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint32_t);
 
 	static const auto DEFAULT_SECTOR_SIZE = UINT32_C(0x800);
 	static const auto DEFAULT_SEGMENT_SIZE = UINT32_C(0x10000);
 
+	static const auto SEQUENTIAL_HINT_MIN_SIZE = UINT64_C(0x100000);
+
+	static const auto UNPACK_BATCH_SIZE = size_t(16);
+
+	static const auto PARALLEL_DECRYPT_MIN_SIZE = UINT64_C(0x400000);
+	static const auto PARALLEL_DECRYPT_CHUNK_SIZE = UINT64_C(0x100000);
+
+	static const auto BATCH_DECRYPT_MAX_SIZE = UINT64_C(0x10000);
+
+	static const auto PARALLEL_UNEXPAND_MIN_SIZE = UINT64_C(0x400000);
+
+	static const auto MIN_STREAM_CHUNK_SIZE = size_t(0x10000);
+
+	static const auto PIPELINE_QUEUE_CAPACITY = size_t(64);
+
+	struct UnpackBatch;
+	struct ReadExtent;
+
 	struct StreamDesc
 	{
 		StreamDesc()
@@ -77,7 +220,7 @@ protected:
 		{
 		}
 
-		std::ifstream stream;
+		InputFile file;
 		std::vector<uint8_t> extHeader;
 		std::string filePath;
 
@@ -96,46 +239,95 @@ protected:
 		m_basePath.clear();
 		m_baseName.clear();
 
-		if (m_mainStream.is_open()) {
-			m_mainStream.close();
-		}
-
-		for (auto& dataStream: m_dataStreams) {
-			if (!dataStream.stream.is_open()) {
-				continue;
-			}
-			dataStream.stream.close();
-		}
+		m_mainFile.close();
 		m_dataStreams.clear();
 
 		m_mainFileSize = 0;
 
-		m_data.clear();
+		m_data = ConstByteSpan();
+		ByteBuffer().swap(m_dataBuffer);
 		m_entryTreeOffsets.clear();
 
 		m_nameTreeOffset = m_extTreeOffset = 0;
 		m_nodeTreeOffset = m_entryTreeCount = 0;
 
 		m_dataOffset = 0;
+
+		m_pathIndex.clear();
+		m_pathTable.clear();
+		m_pathTableReady = false;
+		m_nodeTable.clear();
+		m_nodeTableReady = false;
+
+		m_tocCache.close();
+		m_tocCacheKey = TocCache::Key();
 	}
 
-	bool readDataAt(std::vector<uint8_t>& data, uint64_t offset, uint64_t size)
+	// Working buffer is taken from the buffer pool, callers give it back once they are done with it.
+	bool readNode(const NodeKey& nodeKey, ConstByteSpan& encryptedData, ByteBuffer& data) const;
+	bool unpackNodeStreamed(const NodeKey& nodeKey, const std::string& filePath) const;
+
+	static void sortUnpackPlan(UnpackPlan& plan);
+
+	void readBatch(UnpackBatch& batch, IoRing* ring, ByteBudget& budget) const;
+	void decryptBatch(UnpackBatch& batch) const;
+	void inflateBatch(UnpackBatch& batch, ByteBudget& budget) const;
+	// Returns number of items which failed in any stage.
+	size_t writeBatch(UnpackBatch& batch, IoRing* ring) const;
+
+	bool readExtentsWithRing(ReadExtent* extents, size_t extentCount, IoRing& ring) const;
+	bool writeBatchWithRing(UnpackBatch& batch, IoRing& ring) const;
+
+	template<typename Buffer>
+	bool readDataAt(Buffer& data, uint64_t offset, uint64_t size) const
 	{
-		return readDataAt(m_mainStream, data, offset, size);
+		return readDataAt(m_mainFile, data, offset, size);
 	}
 
-	unsigned int getNodeByPath(const std::string& filePath, NodeKey& nodeKey) const;
+	// Takes TOC from the cache if it is valid, otherwise reads, decrypts and inflates it from the main file.
+	bool loadToc(uint64_t offset, uint64_t size, uint64_t dataSize, uint32_t seed);
+	bool saveTocCache() const;
 
 	bool decryptData(uint8_t* data, uint64_t dataSize, uint32_t seed) const;
+	bool decryptData(const uint8_t* in, uint8_t* out, uint64_t dataSize, uint32_t seed, uint64_t keyOffset = 0) const;
 
-	bool inflateDataIfNeeded(std::vector<uint8_t>& in, uint64_t outSize) const;
+	// Checks for the header of deflated data whose inflated size is the given one.
+	bool isDataCompressed(ConstByteSpan data, uint64_t outSize) const;
+	// Fails if data is not compressed or is corrupt.
+	bool inflateDataIfNeeded(ByteBuffer& in, uint64_t outSize) const;
 
 	virtual std::string normalizeFilePath(const std::string& path) const
 	{
 		return path;
 	}
 
-	bool readDataAt(std::ifstream& stream, std::vector<uint8_t>& data, uint64_t offset, uint64_t size);
+	template<typename Buffer>
+	bool readDataAt(const InputFile& file, Buffer& data, uint64_t offset, uint64_t size) const
+	{
+		data.resize(size);
+
+		return file.readAt(offset, data.data(), data.size());
+	}
+
+	// Returns a view into the file mapping if possible, otherwise reads data into the scratch buffer and returns a view of it.
+	template<typename Buffer>
+	bool viewDataAt(const InputFile& file, ConstByteSpan& view, Buffer& scratch, uint64_t offset, uint64_t size) const
+	{
+		if (file.isMapped()) {
+			view = file.viewAt(offset, size);
+			return view.size() == size;
+		}
+
+		scratch.resize(size);
+		if (!file.readAt(offset, scratch.data(), scratch.size())) {
+			return false;
+		}
+		view = ConstByteSpan(scratch.data(), scratch.size());
+
+		return true;
+	}
+
+	bool prepareStream(InputFile& file, const std::string& filePath, uint64_t* fileSize = nullptr) const;
 
 	virtual bool parseHeader(const uint8_t* header, uint64_t headerSize)
 	{
@@ -149,12 +341,14 @@ protected:
 	boost::filesystem::path m_origPath;
 	boost::filesystem::path m_basePath, m_baseName;
 
-	std::ifstream m_mainStream;
+	InputFile m_mainFile;
 	std::vector<StreamDesc> m_dataStreams;
 
 	uint64_t m_mainFileSize;
 
-	std::vector<uint8_t> m_data;
+	// Views either the own buffer or the mapped TOC cache.
+	ConstByteSpan m_data;
+	ByteBuffer m_dataBuffer;
 	std::vector<uint32_t> m_entryTreeOffsets;
 
 	uint32_t m_nameTreeOffset;
@@ -163,6 +357,26 @@ protected:
 	uint32_t m_entryTreeCount;
 	uint64_t m_dataOffset;
 
+	PathIndex m_pathIndex;
+	mutable PathTable m_pathTable;
+	mutable std::atomic<bool> m_pathTableReady;
+	mutable std::mutex m_pathTableMutex;
+	mutable NodeTable m_nodeTable;
+	mutable std::atomic<bool> m_nodeTableReady;
+	mutable std::mutex m_nodeTableMutex;
+
+	std::string m_tocCachePath;
+	TocCache m_tocCache;
+	TocCache::Key m_tocCacheKey;
+
+	ThreadPool* m_threadPool;
+	mutable BufferPool m_bufferPool;
+	size_t m_streamChunkSize;
+	PipelineConfig m_pipelineConfig;
+	bool m_useMemoryMapping;
+	bool m_useIoRing;
+	bool m_usePathIndex;
+
 	bool m_swapEndian;
 };
 